@@ -3,6 +3,8 @@
 
 #include <assert.h>
 #include <atomic>
+#include <thread>
+#include <utility>
 
 #include <intr_shared_ptr.h>
 
@@ -25,9 +27,25 @@ template <typename T> class atomic_forward_list
     };
     struct node : public link {
         T data;
-        explicit node(const T& x, const link_sptr_t& p) : link(p), data(x) {}
-        ~node() {}
+        template <typename... Args> explicit node(const link_sptr_t& p, Args&&... args) : link(p), data(std::forward<Args>(args)...) {}
+        ~node() {
+            // Dropping the last reference to a long chain must not recurse
+            // through the destructors of all nodes in the chain.
+            if (bool(this->next)) free_chain(this->next.release());
+        }
     };
+    // Release the reference to the chain of nodes starting at n without
+    // recursion: each node referenced only by the caller is unlinked from its
+    // successor before it is deleted. The first node that is still referenced
+    // elsewhere, and the rest of the chain, is left to its other owners.
+    static void free_chain(node* n) {
+        while (n != nullptr && n->ref_cnt.load(std::memory_order_acquire) == 1) {
+            node* next = n->next.release();
+            delete n;
+            n = next;
+        }
+        if (n != nullptr && n->DelRef()) delete n;
+    }
 
     public:
     atomic_forward_list() : head_(), head_p_(static_cast<node*>(&head_)) {
@@ -36,19 +54,26 @@ template <typename T> class atomic_forward_list
     ~atomic_forward_list() {
         this->clear();
     }
+    // Detach the whole chain with a single successful CAS on the head,
+    // then delete the nodes in a loop.
     void clear() {
-        while (bool(head_.next)) {
-          head_.next = head_.next.get()->next;
-        }
+        free_chain(detach().release());
     }
     bool empty() const {
         return !bool(head_.next);
     }
     bool push_front(const T& x) {
+        return emplace_front(x);
+    }
+    bool push_front(T&& x) {
+        return emplace_front(std::move(x));
+    }
+    // Construct the new element in place from args, no copy of T is made.
+    template <typename... Args> bool emplace_front(Args&&... args) {
         // Capture current head.
         link_sptr_t h(head_.next.get());
         // Create new node, link it after the current head.
-        node* n = new node(x, h);
+        node* n = new node(h, std::forward<Args>(args)...);
         // Change the head to point to the new node.
         // If the head changed by another thread, CAS sets h to the new head,
         // so replace "next" pointer in the new node to point to that.
@@ -116,7 +141,7 @@ template <typename T> class atomic_forward_list
         // Capture current position.
         link_sptr_t p(pos.p_->next.get());
         // Create new node, link it after the current position.
-        node* n = new node(x, p);
+        node* n = new node(p, x);
         // Change the current node to point to the new node.
         // If the node changed by another thread, CAS sets p to the new node,
         // so replace "next" pointer in the new node to point to that.
@@ -147,7 +172,113 @@ template <typename T> class atomic_forward_list
         return iterator(p);
     }
 
+    // Local (single-threaded) chain of list nodes. It is used to build a
+    // pre-linked chain of nodes that can be published with push_front_chain(),
+    // and to hold the nodes detached from the shared list by pop_all().
+    class local_list {
+        public:
+        local_list() : head_(), last_(nullptr) {}
+        local_list(local_list&& x) : head_(), last_(x.last_) {
+            head_.next = std::move(x.head_.next);
+            x.last_ = nullptr;
+        }
+        ~local_list() {
+            this->clear();
+        }
+        local_list(const local_list& x) = delete;
+        local_list& operator=(const local_list& x) = delete;
+        void clear() {
+            free_chain(head_.next.release());
+            last_ = nullptr;
+        }
+        bool empty() const {
+            return !bool(head_.next);
+        }
+        void push_front(const T& x) {
+            node* n = new node(head_.next.get(), x);
+            if (!bool(head_.next)) last_ = n;
+            head_.next.reset(n);
+        }
+        bool pop_front(T& x) {
+            link_sptr_t h(head_.next.get());
+            if (!bool(h)) return false;
+            head_.next = h->next;
+            if (!bool(head_.next)) last_ = nullptr;
+            x = h->data;
+            return true;
+        }
+        iterator begin() {
+            return iterator(head_.next.get());
+        }
+        iterator end() {
+            return iterator();
+        }
+
+        private:
+        friend class atomic_forward_list;
+        // The last node is not known for a chain detached by pop_all(), find it
+        // the first time it is needed.
+        node* last() {
+            if (last_ == nullptr && bool(head_.next)) {
+                link_sptr_t p(head_.next.get());
+                while (bool(p->next)) p = p->next.get();
+                last_ = &*p;
+            }
+            return last_;
+        }
+        link head_;
+        node* last_;
+    };
+
+    // Move all nodes from the local list c to the front of this list.
+    // The whole chain is published with a single successful CAS on the head.
+    bool push_front_chain(local_list& c) {
+        if (c.empty()) return false;
+        node* last = c.last();
+        link_sptr_t first(c.head_.next.exchange(static_cast<node*>(nullptr)));
+        c.last_ = nullptr;
+        return push_front_chain(first, last);
+    }
+
+    // Detach all nodes from this list with a single successful CAS on the head,
+    // return them as a local list.
+    local_list pop_all() {
+        local_list c;
+        c.head_.next.reset(detach());
+        return c;
+    }
+
+    // Detach all nodes from this list, like clear(), but delete them on a
+    // background thread. The caller must join or detach the returned thread.
+    std::thread clear_async() {
+        local_list* c = new local_list(pop_all());
+        return std::thread([c]() { delete c; });
+    }
+
     private:
+    // Detach the whole chain from the head with a single successful CAS.
+    link_sptr_t detach() {
+        link_sptr_t h(head_.next.get());
+        while (bool(h) && !head_.next.compare_exchange_strong(h, link_sptr_t())) {}
+        return h;
+    }
+
+    // Link the chain of nodes [first, last] in front of the current head.
+    // The chain must not be reachable by any other thread.
+    bool push_front_chain(const link_sptr_t& first, node* last) {
+        // Capture current head.
+        link_sptr_t h(head_.next.get());
+        // Link the last node of the chain before the current head.
+        last->next.reset(h);
+        // Change the head to point to the first node of the chain.
+        // If the head changed by another thread, CAS sets h to the new head,
+        // so replace "next" pointer in the last node to point to that.
+        while (!head_.next.compare_exchange_strong(h, first)) {
+            last->next.reset(h);
+        }
+        return true;
+    }
+
     link head_;
     link_iptr_t head_p_;
 };
@@ -0,0 +1,177 @@
+#ifndef ATOMIC_INTRUSIVE_FORWARD_LIST_H_
+#define ATOMIC_INTRUSIVE_FORWARD_LIST_H_
+
+#include <assert.h>
+#include <atomic>
+#include <utility>
+
+#include <intr_shared_ptr.h>
+
+// Link embedded in the elements of atomic_intrusive_forward_list.
+// T must be derived from atomic_forward_list_hook<T>:
+//   struct my_type : public atomic_forward_list_hook<my_type> { ... };
+template <typename T> struct atomic_forward_list_hook
+{
+    std::atomic<unsigned long> ref_cnt;
+    intr_shared_ptr<T> next;
+    atomic_forward_list_hook() : ref_cnt(0), next(nullptr) {}
+    ~atomic_forward_list_hook() {
+        // Dropping the last reference to a long chain must not recurse
+        // through the destructors of all elements in the chain.
+        if (bool(next)) free_chain(next.release());
+    }
+    atomic_forward_list_hook(const atomic_forward_list_hook& x) = delete;
+    atomic_forward_list_hook& operator=(const atomic_forward_list_hook& x) = delete;
+    void AddRef() { ref_cnt.fetch_add(1); }
+    bool DelRef() { return ref_cnt.fetch_sub(1) == 1; }
+
+    // Release the reference to the chain of elements starting at n without
+    // recursion, see atomic_forward_list::free_chain().
+    static void free_chain(T* n) {
+        while (n != nullptr && n->ref_cnt.load(std::memory_order_acquire) == 1) {
+            T* next = n->next.release();
+            delete n;
+            n = next;
+        }
+        if (n != nullptr && n->DelRef()) delete n;
+    }
+};
+
+// Intrusive variant of atomic_forward_list: the elements are the nodes, so
+// pushing and popping neither allocates nor copies the payload. Ownership of
+// the elements is transferred by pointer: push_front() takes a new element
+// allocated with new, pop_front() returns a reference-counted handle to the
+// element; the element is deleted when the last handle to it is destroyed.
+template <typename T> class atomic_intrusive_forward_list
+{
+    typedef atomic_forward_list_hook<T> link;
+    typedef intr_shared_ptr<T> link_iptr_t;
+    typedef typename link_iptr_t::shared_ptr link_sptr_t;
+
+    public:
+    typedef link_sptr_t pointer;
+
+    atomic_intrusive_forward_list() : head_() {
+        head_.AddRef(); // Make sure head is not deleted by any smart pointer
+    }
+    ~atomic_intrusive_forward_list() {
+        this->clear();
+    }
+    // Detach the whole chain with a single successful CAS on the head,
+    // then delete the elements that are not referenced elsewhere.
+    void clear() {
+        link_sptr_t h(head_.next.get());
+        while (bool(h) && !head_.next.compare_exchange_strong(h, link_sptr_t())) {}
+        link::free_chain(h.release());
+    }
+    bool empty() const {
+        return !bool(head_.next);
+    }
+
+    // Push new element, the list takes ownership of x.
+    // x must not be in any list or referenced by any handle.
+    bool push_front(T* x) {
+        assert(x->ref_cnt.load(std::memory_order_relaxed) == 0);
+        // Capture current head.
+        link_sptr_t h(head_.next.get());
+        // Link the new element before the current head.
+        x->next.reset(h);
+        // Change the head to point to the new element.
+        // If the head changed by another thread, CAS sets h to the new head,
+        // so replace "next" pointer in the new element to point to that.
+        while (!head_.next.compare_exchange_strong(h, x)) {
+            x->next.reset(h);
+        }
+        return true;
+    }
+
+    // Push back an element returned by pop_front(). This is allowed only if
+    // x is the only reference to the element: otherwise another thread may
+    // be in the middle of pop_front() with this element as the head, and
+    // reusing it would corrupt the list (ABA). Returns false and leaves x
+    // unchanged in that case; on success, x is reset.
+    bool push_front(pointer& x) {
+        if (!bool(x) || x->ref_cnt.load(std::memory_order_acquire) != 1) return false;
+        // Capture current head.
+        link_sptr_t h(head_.next.get());
+        x->next.reset(h);
+        // On success, the reference held by x is moved into the list.
+        while (!head_.next.compare_exchange_strong(h, std::move(x))) {
+            x->next.reset(h);
+        }
+        return true;
+    }
+
+    // Allocate and push new element constructed from args.
+    template <typename... Args> bool emplace_front(Args&&... args) {
+        return push_front(new T(std::forward<Args>(args)...));
+    }
+
+    bool pop_front(pointer& x) {
+        // Capture current head.
+        link_sptr_t h(head_.next.get());
+        if (!bool(h)) return false;
+        // Change the head to point to the new head (next node).
+        // If the head changed by another thread, CAS sets h to the new head,
+        // so replace "next" pointer in the new node to point to that.
+        while (!head_.next.compare_exchange_strong(h, h->next.get())) {
+            if (!bool(h)) return false;
+        }
+        // Drop the link to the rest of the list: otherwise the popped element
+        // holds a reference to its successor (which then cannot be pushed
+        // back) and keeps the old chain alive. Another thread still in
+        // pop_front() with h as the head cannot win its CAS any more.
+        h->next.reset(static_cast<T*>(nullptr));
+        x = std::move(h);
+        return true;
+    }
+
+    class iterator {
+        public:
+        ~iterator() {}
+        explicit operator bool() const { return bool(p_); }
+        T* operator->() const { return &*p_; }
+        T& operator*() const { return *p_; }
+        iterator operator++() {
+            p_ = p_->next.get();
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp(*this);
+            p_ = p_->next.get();
+            return tmp;
+        }
+        bool operator==(const iterator& rhs) const {
+            return p_ == rhs.p_;
+        }
+        bool operator!=(const iterator& rhs) const {
+            return p_ != rhs.p_;
+        }
+        private:
+        link_sptr_t p_;
+        friend class atomic_intrusive_forward_list;
+        explicit iterator(const link_sptr_t& p) : p_(p) {}
+        iterator() : p_() {}
+    };
+
+    iterator begin() {
+        return iterator(head_.next.get());
+    }
+
+    iterator end() {
+        return iterator();
+    }
+
+    iterator find(const T& x) const {
+        link_sptr_t p(head_.next.get());
+        while (p && !(*p == x)) {
+            p = p->next.get();
+        }
+        return iterator(p);
+    }
+
+    private:
+    link head_;
+};
+
+#endif // ATOMIC_INTRUSIVE_FORWARD_LIST_H_
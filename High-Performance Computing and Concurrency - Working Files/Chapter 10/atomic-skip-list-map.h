@@ -0,0 +1,318 @@
+#ifndef ATOMIC_SKIP_LIST_MAP_H_
+#define ATOMIC_SKIP_LIST_MAP_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <intr_shared_ptr.h>
+
+// Lock-free ordered map based on a skip list. The nodes are linked and
+// reclaimed with intr_shared_ptr, like the nodes of atomic_forward_list.
+//
+// A node is erased in two steps. First, every link out of the node is
+// "marked" by replacing it with a marker node that points to the old
+// successor. A CAS that expects the old successor then fails, so no node can
+// be inserted after an erased node. The node whose level 0 link is marked is
+// logically deleted. Then the node is unlinked from its predecessors, either
+// by the eraser or by any other thread that finds it during a search.
+//
+// Iteration is weakly consistent: an iterator never returns a node that was
+// erased before the iterator reached it, and it may or may not see the
+// changes made concurrently with the iteration.
+template <typename K, typename V, typename Compare = std::less<K>, int MaxHeight = 16> class atomic_skip_list_map
+{
+    static_assert(MaxHeight > 0 && MaxHeight <= 32, "Invalid skip list height");
+    public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<const K, V> value_type;
+
+    private:
+    enum node_kind { head_node, data_node, marker_node };
+    struct node;
+    typedef intr_shared_ptr<node> link_iptr_t;
+    typedef typename link_iptr_t::shared_ptr link_sptr_t;
+    // The links next(0) ... next(height - 1) are allocated right after the node.
+    struct node {
+        std::atomic<unsigned long> ref_cnt;
+        const int height;
+        const node_kind kind;
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type storage;
+
+        static node* create(node_kind kind, int height) {
+            void* mem = ::operator new(sizeof(node) + height*sizeof(link_iptr_t));
+            return new (mem) node(kind, height);
+        }
+        template <typename... Args> static node* create_data(int height, Args&&... args) {
+            node* n = create(data_node, height);
+            new (&n->storage) value_type(std::forward<Args>(args)...);
+            return n;
+        }
+        static void operator delete(void* p) { ::operator delete(p); }
+        ~node() {
+            // Links above level 0 never hold the last reference to a node
+            // that is still linked at level 0, release them first.
+            for (int i = 1; i < height; ++i) {
+                if (bool(next(i))) next(i).reset(static_cast<node*>(nullptr));
+            }
+            // Dropping the last reference to a long chain must not recurse
+            // through the destructors of all nodes in the chain.
+            if (bool(next(0))) free_chain(next(0).release());
+            for (int i = 0; i < height; ++i) next(i).~link_iptr_t();
+            if (kind == data_node) value().~value_type();
+        }
+        node(const node& x) = delete;
+        node& operator=(const node& x) = delete;
+        void AddRef() { ref_cnt.fetch_add(1); }
+        bool DelRef() { return ref_cnt.fetch_sub(1) == 1; }
+
+        link_iptr_t& next(int i) { return reinterpret_cast<link_iptr_t*>(this + 1)[i]; }
+        value_type& value() { return *reinterpret_cast<value_type*>(&storage); }
+        const K& key() { return value().first; }
+        bool is_marker() const { return kind == marker_node; }
+
+        private:
+        node(node_kind kind, int height) : ref_cnt(0), height(height), kind(kind) {
+            for (int i = 0; i < height; ++i) new (&next(i)) link_iptr_t();
+        }
+    };
+
+    // Release the reference to the chain of nodes starting at n without
+    // recursion, see atomic_forward_list::free_chain().
+    static void free_chain(node* n) {
+        while (n != nullptr && n->ref_cnt.load(std::memory_order_acquire) == 1) {
+            for (int i = 1; i < n->height; ++i) {
+                if (bool(n->next(i))) n->next(i).reset(static_cast<node*>(nullptr));
+            }
+            node* next = n->next(0).release();
+            delete n;
+            n = next;
+        }
+        if (n != nullptr && n->DelRef()) delete n;
+    }
+
+    public:
+    atomic_skip_list_map() : head_(node::create(head_node, MaxHeight)) {}
+    ~atomic_skip_list_map() {
+        this->clear();
+        delete head_;
+    }
+    atomic_skip_list_map(const atomic_skip_list_map& x) = delete;
+    atomic_skip_list_map& operator=(const atomic_skip_list_map& x) = delete;
+
+    // Remove all nodes. Nodes inserted concurrently with clear() may remain.
+    void clear() {
+        for (int i = MaxHeight - 1; i > 0; --i) head_->next(i).reset(static_cast<node*>(nullptr));
+        free_chain(head_->next(0).release());
+    }
+
+    bool empty() const {
+        return begin() == end();
+    }
+
+    class iterator {
+        public:
+        ~iterator() {}
+        explicit operator bool() const { return bool(p_); }
+        value_type* operator->() const { return &(p_->value()); }
+        value_type& operator*() const { return p_->value(); }
+        iterator operator++() {
+            p_ = next_live(p_->next(0).get());
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp(*this);
+            p_ = next_live(p_->next(0).get());
+            return tmp;
+        }
+        bool operator==(const iterator& rhs) const {
+            return p_ == rhs.p_;
+        }
+        bool operator!=(const iterator& rhs) const {
+            return p_ != rhs.p_;
+        }
+        private:
+        link_sptr_t p_;
+        friend class atomic_skip_list_map;
+        explicit iterator(const link_sptr_t& p) : p_(p) {}
+        iterator() : p_() {}
+    };
+
+    iterator begin() const {
+        return iterator(next_live(head_->next(0).get()));
+    }
+
+    iterator end() const {
+        return iterator();
+    }
+
+    // Insert the value if the key is not in the map.
+    // Returns false if the key is already in the map.
+    bool insert(const K& key, const V& value) {
+        link_sptr_t preds[MaxHeight], succs[MaxHeight];
+        if (search(key, preds, succs)) return false;
+        const int height = random_height();
+        node* n = node::create_data(height, key, value);
+        const link_iptr_t hold(n);  // Keeps n alive if it is erased while linking
+        for (int i = 0; i < height; ++i) n->next(i).reset(succs[i]);
+        // Link the new node at level 0, this makes it a part of the map.
+        // If the predecessor changed or was erased, search again.
+        while (!node_or_head(preds[0])->next(0).compare_exchange_strong(succs[0], n)) {
+            if (search(key, preds, succs)) return false;
+            for (int i = 0; i < height; ++i) n->next(i).reset(succs[i]);
+        }
+        // Link the upper levels, these are only shortcuts for the search.
+        for (int i = 1; i < height; ++i) {
+            while (true) {
+                // Point the link of the new node to the successor found by
+                // the last search, unless the link was marked by an erase.
+                link_sptr_t s(n->next(i).get());
+                if (bool(s) && s->is_marker()) return true;
+                if (s != succs[i] && !n->next(i).compare_exchange_strong(s, succs[i])) return true;
+                if (node_or_head(preds[i])->next(i).compare_exchange_strong(succs[i], n)) break;
+                if (!search(key, preds, succs) || &*succs[0] != n) return true;    // Erased already
+            }
+            // If the node was erased while it was linked at this level, the
+            // search in erase() may have missed it, unlink it here.
+            link_sptr_t s(n->next(i).get());
+            if (bool(s) && s->is_marker()) {
+                search(key, preds, succs);
+                return true;
+            }
+        }
+        return true;
+    }
+
+    // Returns false if the key is not in the map.
+    bool erase(const K& key) {
+        link_sptr_t preds[MaxHeight], succs[MaxHeight];
+        if (!search(key, preds, succs)) return false;
+        link_sptr_t n(succs[0]);
+        // Mark the upper levels top-down, then level 0. Whoever marks
+        // level 0 erases the node.
+        for (int i = n->height - 1; i >= 0; --i) {
+            link_sptr_t s(n->next(i).get());
+            while (!bool(s) || !s->is_marker()) {
+                node* m = node::create(marker_node, 1);
+                m->next(0).reset(s);
+                if (n->next(i).compare_exchange_strong(s, m)) {
+                    if (i == 0) {
+                        search(key, preds, succs);  // Unlink the node
+                        return true;
+                    }
+                    break;
+                }
+                delete m;
+            }
+        }
+        return false;   // Erased by another thread
+    }
+
+    iterator find(const K& key) const {
+        link_sptr_t p(lower_bound_node(key));
+        if (bool(p) && !less_(key, p->key())) return iterator(p);
+        return iterator();
+    }
+
+    // First element with the key not less than key.
+    iterator lower_bound(const K& key) const {
+        return iterator(lower_bound_node(key));
+    }
+
+    private:
+    // The searches start from the head without a handle to it (the map holds
+    // it), an empty predecessor stands for the head.
+    node* node_or_head(const link_sptr_t& p) const {
+        return bool(p) ? &*p : head_;
+    }
+
+    // Skip markers and logically deleted nodes starting at p.
+    static link_sptr_t next_live(link_sptr_t p) {
+        while (bool(p)) {
+            if (p->is_marker()) {
+                p = p->next(0).get();
+                continue;
+            }
+            link_sptr_t s(p->next(0).get());
+            if (!bool(s) || !s->is_marker()) break;
+            p = s->next(0).get();
+        }
+        return p;
+    }
+
+    // Read-only search: does not unlink erased nodes, so it never restarts.
+    link_sptr_t lower_bound_node(const K& key) const {
+        link_sptr_t pred;
+        link_sptr_t curr;
+        for (int i = MaxHeight - 1; i >= 0; --i) {
+            curr = node_or_head(pred)->next(i).get();
+            while (bool(curr)) {
+                if (curr->is_marker()) {            // pred is being erased
+                    curr = curr->next(0).get();
+                    continue;
+                }
+                link_sptr_t succ(curr->next(i).get());
+                if (bool(succ) && succ->is_marker()) { // curr is being erased
+                    curr = succ->next(0).get();
+                    continue;
+                }
+                if (!less_(curr->key(), key)) break;
+                pred = std::move(curr);
+                curr = std::move(succ);
+            }
+        }
+        return next_live(curr);
+    }
+
+    // Find the predecessors and successors of key on all levels, unlink
+    // marked nodes on the way. Returns true if succs[0] has the key. The
+    // predecessors are empty where the head is the predecessor.
+    bool search(const K& key, link_sptr_t* preds, link_sptr_t* succs) {
+        retry:
+        link_sptr_t pred;
+        for (int i = MaxHeight - 1; i >= 0; --i) {
+            link_sptr_t curr(node_or_head(pred)->next(i).get());
+            while (true) {
+                if (bool(curr) && curr->is_marker()) goto retry;   // pred is erased
+                if (!bool(curr)) break;
+                link_sptr_t succ(curr->next(i).get());
+                if (bool(succ) && succ->is_marker()) {
+                    // curr is erased, unlink it at this level.
+                    link_sptr_t s(succ->next(0).get());
+                    if (!node_or_head(pred)->next(i).compare_exchange_strong(curr, s)) goto retry;
+                    curr = s;
+                    continue;
+                }
+                if (!less_(curr->key(), key)) break;
+                pred = std::move(curr);
+                curr = std::move(succ);
+            }
+            preds[i] = pred;
+            succs[i] = curr;
+        }
+        return bool(succs[0]) && !less_(key, succs[0]->key());
+    }
+
+    static int random_height() {
+        static thread_local uint64_t x = 0x9E3779B97F4A7C15ULL ^ uint64_t(uintptr_t(&x));
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        // Geometric distribution with p = 1/2.
+        int h = 1;
+        for (uint64_t bits = x; (bits & 1) && h < MaxHeight; bits >>= 1) ++h;
+        return h;
+    }
+
+    // Owned by the map and never erased, so the threads use it without
+    // taking a reference.
+    node* const head_;
+    Compare less_;
+};
+
+#endif // ATOMIC_SKIP_LIST_MAP_H_
@@ -0,0 +1,221 @@
+#ifndef ATOMIC_UNROLLED_FORWARD_LIST_H_
+#define ATOMIC_UNROLLED_FORWARD_LIST_H_
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <type_traits>
+
+#include <intr_shared_ptr.h>
+
+// Default number of elements per node: fill two cache lines, at most 32
+// elements (one bit per element in the node masks).
+template <typename T> struct unrolled_list_slots {
+    static const size_t bytes = 2*64 - 32;
+    static const size_t value = sizeof(T) >= bytes ? 1 : (bytes/sizeof(T) > 32 ? 32 : bytes/sizeof(T));
+};
+
+// Unrolled variant of atomic_forward_list: each cache-line-aligned node holds
+// up to N elements, so find() follows one pointer per N elements instead of
+// one pointer per element. push_front() appends to a free slot in the head
+// node without locking, and links a new head node only when the current one
+// is full. Elements removed by pop_front() are destroyed when their node is
+// deleted. There is no insert_after()/erase_after() in the middle of the list.
+template <typename T, size_t N = unrolled_list_slots<T>::value> class atomic_unrolled_forward_list
+{
+    static_assert(N > 0 && N <= 32, "Node masks hold at most 32 elements");
+    struct link;
+    struct node;
+    typedef intr_shared_ptr<node> link_iptr_t;
+    typedef typename link_iptr_t::shared_ptr link_sptr_t;
+    struct link {
+        std::atomic<unsigned long> ref_cnt;
+        link_iptr_t next;
+        link() : ref_cnt(0), next(nullptr) {}
+        explicit link(const link_sptr_t& p) : ref_cnt(0), next(p) {}
+        ~link() {}
+        link(const link& x) = delete;
+        link& operator=(const link& x) = delete;
+        void AddRef() { ref_cnt.fetch_add(1); }
+        bool DelRef() { return ref_cnt.fetch_sub(1) == 1; }
+    };
+    struct alignas(64) node : public link {
+        std::atomic<unsigned int> reserved;     // Slots claimed by writers
+        std::atomic<uint32_t> constructed;      // Bit i set once data(i) is constructed
+        std::atomic<uint32_t> popped;           // Bit i set once data(i) is removed
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type slots[N];
+        explicit node(const T& x, const link_sptr_t& p) : link(p), reserved(1), constructed(0), popped(0) {
+            new (slots) T(x);
+            constructed.store(1, std::memory_order_release);
+        }
+        ~node() {
+            const uint32_t c = constructed.load(std::memory_order_acquire);
+            for (size_t i = 0; i != N; ++i) {
+                if (c & (1u << i)) data(i).~T();
+            }
+        }
+        T& data(size_t i) { return *reinterpret_cast<T*>(slots + i); }
+        // Mask of elements that are constructed and not yet popped.
+        uint32_t live() const {
+            return constructed.load(std::memory_order_acquire) & ~popped.load(std::memory_order_acquire);
+        }
+        // All slots are constructed and popped, no writer can add to this node.
+        bool exhausted() const {
+            return popped.load(std::memory_order_acquire) == all_slots;
+        }
+        // Lock-free append into a free slot, fails if the node is full.
+        bool append(const T& x) {
+            if (reserved.load(std::memory_order_relaxed) >= N) return false;
+            const unsigned int i = reserved.fetch_add(1, std::memory_order_relaxed);
+            if (i >= N) return false;
+            new (slots + i) T(x);
+            constructed.fetch_or(1u << i, std::memory_order_release);
+            return true;
+        }
+        static void* operator new(size_t s) {
+            void* p = NULL;
+            if (::posix_memalign(&p, 64, s) != 0) throw std::bad_alloc();
+            return p;
+        }
+        static void operator delete(void* p) { ::free(p); }
+        static const uint32_t all_slots = uint32_t(-1) >> (32 - N);
+    };
+    // Highest slot in the mask below slot i, -1 if there is none.
+    // Slots are filled in increasing order, so the highest slot is the front.
+    static int next_slot(uint32_t mask, int i) {
+        mask &= uint32_t((uint64_t(1) << i) - 1);
+        return mask ? 31 - __builtin_clz(mask) : -1;
+    }
+
+    public:
+    atomic_unrolled_forward_list() : head_() {
+        head_.AddRef(); // Make sure head is not deleted by any smart pointer
+    }
+    ~atomic_unrolled_forward_list() {
+        this->clear();
+    }
+    void clear() {
+        while (bool(head_.next)) {
+          head_.next = head_.next.get()->next;
+        }
+    }
+    bool empty() const {
+        for (link_sptr_t p(head_.next.get()); bool(p); p = p->next.get()) {
+            if (p->live() != 0) return false;
+        }
+        return true;
+    }
+    bool push_front(const T& x) {
+        // Capture current head.
+        link_sptr_t h(head_.next.get());
+        // Append to the head node if it has free slots.
+        if (bool(h) && h->append(x)) return true;
+        // Create new node, link it after the current head.
+        node* n = new node(x, h);
+        // Change the head to point to the new node.
+        // If the head changed by another thread, CAS sets h to the new head,
+        // try to append to it before linking the new node again.
+        while (!head_.next.compare_exchange_strong(h, n)) {
+            if (bool(h) && h->append(x)) {
+                delete n;
+                return true;
+            }
+            n->next.reset(h);
+        }
+        return true;
+    }
+
+    bool pop_front(T& x) {
+        link* prev = &head_;
+        link_sptr_t prev_p;     // Holds prev if it is not the head
+        link_sptr_t p(head_.next.get());
+        while (bool(p)) {
+            // Claim the most recently added element in this node.
+            for (uint32_t live = p->live(); live != 0; live = p->live()) {
+                const int i = next_slot(live, N);
+                if (!(p->popped.fetch_or(1u << i, std::memory_order_acq_rel) & (1u << i))) {
+                    x = p->data(i);
+                    return true;
+                }
+            }
+            // Nothing left in this node, unlink it if no writer can add to it.
+            link_sptr_t next(p->next.get());
+            if (p->exhausted()) {
+                link_sptr_t pp(p);
+                prev->next.compare_exchange_strong(pp, next);
+            }
+            prev_p = p;
+            prev = &*prev_p;
+            p = next;
+        }
+        return false;
+    }
+
+    class iterator {
+        public:
+        ~iterator() {}
+        explicit operator bool() const { return bool(p_); }
+        T* operator->() const { return &(p_->data(i_)); }
+        T& operator*() const { return p_->data(i_); }
+        iterator operator++() {
+            advance();
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator tmp(*this);
+            advance();
+            return tmp;
+        }
+        bool operator==(const iterator& rhs) const {
+            return p_ == rhs.p_ && i_ == rhs.i_;
+        }
+        bool operator!=(const iterator& rhs) const {
+            return !(*this == rhs);
+        }
+        private:
+        link_sptr_t p_;
+        int i_;
+        friend class atomic_unrolled_forward_list;
+        iterator(const link_sptr_t& p, int i) : p_(p), i_(i) {}
+        iterator() : p_(), i_(-1) {}
+        // Position on the first live element below slot i of p_,
+        // moving on to the following nodes if there is none.
+        void seek(int i) {
+            for (; bool(p_); p_ = p_->next.get(), i = N) {
+                i_ = next_slot(p_->live(), i);
+                if (i_ >= 0) return;
+            }
+            i_ = -1;
+        }
+        void advance() { seek(i_); }
+    };
+
+    iterator begin() {
+        iterator it(head_.next.get(), -1);
+        it.seek(N);
+        return it;
+    }
+
+    iterator end() {
+        return iterator();
+    }
+
+    iterator find(const T& x) const {
+        link_sptr_t p(head_.next.get());
+        while (bool(p)) {
+            const uint32_t live = p->live();
+            for (int i = next_slot(live, N); i >= 0; i = next_slot(live, i)) {
+                if (p->data(i) == x) return iterator(p, i);
+            }
+            p = p->next.get();
+        }
+        return iterator();
+    }
+
+    private:
+    link head_;
+};
+
+#endif // ATOMIC_UNROLLED_FORWARD_LIST_H_
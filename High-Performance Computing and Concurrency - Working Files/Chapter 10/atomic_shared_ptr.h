@@ -41,11 +41,29 @@
 #define _JSS_ATOMIC_SHARED_PTR
 #include <atomic>
 #include <memory>
+#include <stdint.h>
+#include <string.h>
 
 namespace jss{
 template<class T> class shared_ptr;
 template<class T> class weak_ptr;
 
+#ifdef _MSC_VER
+#define JSS_ASP_ALIGN_TO(alignment) __declspec(align(alignment))
+#ifdef _WIN64
+#define JSS_ASP_BITFIELD_SIZE 32
+#else
+#define JSS_ASP_BITFIELD_SIZE 16
+#endif
+#else
+#define JSS_ASP_ALIGN_TO(alignment) __attribute__((aligned(alignment)))
+#ifdef __LP64__
+#define JSS_ASP_BITFIELD_SIZE 32
+#else
+#define JSS_ASP_BITFIELD_SIZE 16
+#endif
+#endif
+
 struct shared_ptr_data_block_base{};
 
 template<class D>
@@ -73,15 +91,19 @@ struct shared_ptr_deleter_base<void>{
 };
 
 struct shared_ptr_header_block_base{
-    struct counter{
-        unsigned external_counters;
-        int count;
-
-        counter() noexcept:
-            external_counters(0),
-            count(1)
-        {}
-    };
+    // The counts are one word, so that they can be changed with fetch_add:
+    // the low 32 bits count the shared_ptrs, the next 31 bits are the
+    // external counters of atomic_shared_ptrs, and the top bit is set once
+    // the object is deleted. When the counts drop to zero, the object is
+    // deleted by the thread that sets the top bit on the zero word.
+    // weak_ptr::lock() increments the count without a CAS loop: if the top
+    // bit was set it undoes the increment and fails. If the counts were zero
+    // but the bit was not set yet, lock() revives the object, and the thread
+    // that zeroed the counts fails to set the bit.
+    typedef uint64_t counter;
+    static counter const count_one=1;
+    static counter const external_one=counter(1)<<32;
+    static counter const deleted=counter(1)<<63;
 
     static unsigned const cast_pointer_count=3;
     struct ptr_extension_block{
@@ -142,12 +164,32 @@ struct shared_ptr_header_block_base{
 
     unsigned use_count()
     {
-        counter c=count.load(std::memory_order_relaxed);
-        return c.count+(c.external_counters?1:0);
+        counter const c=count.load(std::memory_order_relaxed);
+        if(c&deleted)
+            return 0;
+        return unsigned(c)+((c/external_one)?1:0);
     }
 
+    // Index of an aliasing pointer for atomic_shared_ptr, which stores the
+    // index rather than the pointer. The first pointer stored gets index 0.
+    // Pointers close to it, such as upcasts and pointers to members of the
+    // same object, get an index with offset_flag set that holds their offset
+    // from the first pointer, so they need no search and no extension blocks.
+    // Only the other pointers go into the cast_pointers table.
+    static unsigned const offset_flag=1u<<(JSS_ASP_BITFIELD_SIZE-1);
+
     unsigned get_ptr_index(void* p)
     {
+        void* first=cp_extension.cast_pointers[0].load();
+        if(!first && cp_extension.cast_pointers[0].compare_exchange_strong(first,p))
+            return 0;
+        if(first==p)
+            return 0;
+        intptr_t const offset=
+            reinterpret_cast<intptr_t>(p)-reinterpret_cast<intptr_t>(first);
+        intptr_t const limit=offset_flag/2;
+        if(offset>=-limit && offset<limit)
+            return offset_flag|(static_cast<unsigned>(offset)&(offset_flag-1));
         return cp_extension.get_ptr_index(p);
     }
 
@@ -157,15 +199,29 @@ struct shared_ptr_header_block_base{
     template<typename T>
     T* get_ptr(unsigned index)
     {
+        if(index&offset_flag){
+            unsigned const bits=index&(offset_flag-1);
+            intptr_t const offset=(bits&(offset_flag/2))?
+                intptr_t(bits)-intptr_t(offset_flag):intptr_t(bits);
+            return static_cast<T*>(reinterpret_cast<void*>(
+                reinterpret_cast<intptr_t>(cp_extension.cast_pointers[0].load())+offset));
+        }
         return static_cast<T*>(cp_extension.get_pointer(index));
     }
     
     shared_ptr_header_block_base():
-        count(counter()),weak_count(1)
+        count(count_one),weak_count(1)
     {}
 
     virtual void do_delete()=0;
 
+    // Free the header block itself, overridden by the blocks that come
+    // from an allocator.
+    virtual void destroy_header()
+    {
+        delete this;
+    }
+
     void delete_object()
     {
         do_delete();
@@ -175,7 +231,7 @@ struct shared_ptr_header_block_base{
     void dec_weak_count()
     {
         if(weak_count.fetch_add(-1)==1){
-            delete this;
+            destroy_header();
         }
     }
 
@@ -184,65 +240,47 @@ struct shared_ptr_header_block_base{
         ++weak_count;
     }
 
-    void dec_count()
+    // The counts dropped to zero: delete the object, unless a weak_ptr
+    // revived it or another thread deleted it after a revival.
+    void release_object()
     {
-        counter old=count.load(std::memory_order_relaxed);
-        for(;;){
-            counter new_count=old;
-            --new_count.count;
-            if(count.compare_exchange_weak(old,new_count))
-                break;
-        }
-        if((old.count==1) && !old.external_counters){
+        counter zero=0;
+        if(count.compare_exchange_strong(zero,deleted)){
             delete_object();
         }
     }
 
-    bool shared_from_weak()
+    void dec_count()
     {
-        counter old=count.load(std::memory_order_relaxed);
-        while(old.count||old.external_counters){
-            counter new_count=old;
-            ++new_count.count;
-            if(count.compare_exchange_weak(old,new_count))
-                return true;
+        if(count.fetch_sub(count_one)==count_one){
+            release_object();
         }
+    }
+
+    bool shared_from_weak()
+    {
+        if(count.load(std::memory_order_relaxed)&deleted)
+            return false;       // Deleted for good, no need to write
+        if(!(count.fetch_add(count_one)&deleted))
+            return true;
+        count.fetch_sub(count_one,std::memory_order_relaxed);
         return false;
     }
 
     void inc_count()
     {
-        counter old=count.load(std::memory_order_relaxed);
-        for(;;){
-            counter new_count=old;
-            ++new_count.count;
-            if(count.compare_exchange_weak(old,new_count))
-                break;
-        }
+        count.fetch_add(count_one,std::memory_order_relaxed);
     }
     
     void add_external_counters(unsigned external_count)
     {
-        counter old=count.load(std::memory_order_relaxed);
-        for(;;){
-            counter new_count=old;
-            new_count.external_counters+=external_count;
-            if(count.compare_exchange_weak(old,new_count))
-                break;
-        }
+        count.fetch_add(external_one*external_count);
     }
 
     void remove_external_counter()
     {
-        counter old=count.load(std::memory_order_relaxed);
-        for(;;){
-            counter new_count=old;
-            --new_count.external_counters;
-            if(count.compare_exchange_weak(old,new_count))
-                break;
-        }
-        if(!old.count && (old.external_counters==1)){
-            delete_object();
+        if(count.fetch_sub(external_one)==external_one){
+            release_object();
         }
     }
     
@@ -305,8 +343,49 @@ struct shared_ptr_header_combined:
     }
 };
 
+// Header blocks allocated with an allocator A. The allocator is rebound to
+// the header type and kept in the header to free it.
+template<class H,class A>
+struct shared_ptr_header_allocated:
+        public H{
+    typedef typename std::allocator_traits<A>::template
+    rebind_alloc<shared_ptr_header_allocated> allocator_type;
+    typedef std::allocator_traits<allocator_type> traits;
+    allocator_type alloc;
+
+    template<typename ... Args>
+    shared_ptr_header_allocated(A const& a,Args&& ... args):
+        H(static_cast<Args&&>(args)...),alloc(a)
+    {}
+
+    template<typename ... Args>
+    static shared_ptr_header_allocated* create(A const& a,Args&& ... args)
+    {
+        allocator_type alloc(a);
+        shared_ptr_header_allocated* const h=traits::allocate(alloc,1);
+        try{
+            new(static_cast<void*>(h)) shared_ptr_header_allocated(
+                a,static_cast<Args&&>(args)...);
+        }
+        catch(...){
+            traits::deallocate(alloc,h,1);
+            throw;
+        }
+        return h;
+    }
+
+    void destroy_header()
+    {
+        allocator_type alloc_copy(alloc);
+        this->~shared_ptr_header_allocated();
+        traits::deallocate(alloc_copy,this,1);
+    }
+};
+
 template<typename T,typename ... Args>
 shared_ptr<T> make_shared(Args&& ... args);
+template<typename T,typename A,typename ... Args>
+shared_ptr<T> allocate_shared(A const& a,Args&& ... args);
 
 template<class T> class shared_ptr {
 private:
@@ -322,6 +401,8 @@ private:
 
     template<typename U,typename ... Args>
     friend shared_ptr<U> make_shared(Args&& ... args);
+    template<typename U,typename A,typename ... Args>
+    friend shared_ptr<U> allocate_shared(A const& a,Args&& ... args);
 
     shared_ptr(shared_ptr_header_block_base* header_,unsigned index):
         ptr(header_?header_->get_ptr<T>(index):nullptr),header(header_)
@@ -384,8 +465,25 @@ public:
         d(p);
     }
     
-    template<class Y, class D, class A> shared_ptr(Y* p, D d, A a);
-    template <class D, class A> shared_ptr(std::nullptr_t p, D d, A a);
+    template<class Y, class D, class A> shared_ptr(Y* p, D d, A a)
+    try:
+        ptr(p),
+        header(shared_ptr_header_allocated<
+               shared_ptr_header_separate<Y*,D>,A>::create(a,p,d))
+    {}
+    catch(...){
+        d(p);
+    }
+
+    template <class D, class A> shared_ptr(std::nullptr_t p, D d, A a)
+    try:
+        ptr(p),
+        header(shared_ptr_header_allocated<
+               shared_ptr_header_separate<std::nullptr_t,D>,A>::create(a,p,d))
+    {}
+    catch(...){
+        d(p);
+    }
     
     template<class Y> shared_ptr(const shared_ptr<Y>& r, T* p) noexcept:
         ptr(p),header(r.header)
@@ -514,7 +612,12 @@ public:
         swap(temp);
     }
     
-    template<class Y, class D, class A> void reset(Y* p, D d, A a);
+    template<class Y, class D, class A> void reset(Y* p, D d, A a)
+    {
+        shared_ptr temp(p,d,a);
+        swap(temp);
+    }
+
     // 20.8.2.2.5, observers:
     T* get() const noexcept
     {
@@ -567,6 +670,15 @@ shared_ptr<T> make_shared(Args&& ... args){
             static_cast<Args&&>(args)...));
 }
 
+template<typename T,typename A,typename ... Args>
+shared_ptr<T> allocate_shared(A const& a,Args&& ... args){
+    typedef shared_ptr_header_combined<T> header_type;
+    header_type* const header=
+        shared_ptr_header_allocated<header_type,A>::create(
+            a,static_cast<Args&&>(args)...);
+    return shared_ptr<T>(header);
+}
+
 template<class T> class weak_ptr {
     T* ptr;
     shared_ptr_header_block_base* header;
@@ -692,20 +804,166 @@ public:
     template<class U> bool owner_before(weak_ptr<U> const& b) const;
 };
 
-#ifdef _MSC_VER
-#define JSS_ASP_ALIGN_TO(alignment) __declspec(align(alignment))
-#ifdef _WIN64
-#define JSS_ASP_BITFIELD_SIZE 32
-#else
-#define JSS_ASP_BITFIELD_SIZE 16
+// The counted pointer of atomic_shared_ptr is two words. std::atomic of a
+// 16-byte struct goes through out-of-line library calls that may use a lock.
+// On x86-64 processors that have cmpxchg16b (checked once at run time) all
+// operations are inline lock cmpxchg16b instead, except for loads on Intel
+// and AMD processors with AVX, where aligned 16-byte SSE loads are atomic and
+// do not need to write the cache line. Define
+// JSS_ASP_NO_CMPXCHG16B to always use the library. The thread sanitizer does
+// not see inline assembly, so it gets the library too.
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__SANITIZE_THREAD__) && !defined(JSS_ASP_NO_CMPXCHG16B)
+#define JSS_ASP_CMPXCHG16B
 #endif
+
+#ifdef JSS_ASP_CMPXCHG16B
+} // namespace jss
+#include <cpuid.h>
+namespace jss{
+
+inline bool has_cmpxchg16b()
+{
+    static bool const cx16=[]{
+        unsigned a,b,c,d;
+        return __get_cpuid(1,&a,&b,&c,&d) && (c&bit_CMPXCHG16B);
+    }();
+    return cx16;
+}
+
+inline bool has_atomic_sse_load()
+{
+    static bool const sse=[]{
+        unsigned a,b,c,d;
+        if(!__get_cpuid(0,&a,&b,&c,&d))
+            return false;
+        bool const vendor=
+            (b==signature_INTEL_ebx && c==signature_INTEL_ecx && d==signature_INTEL_edx) ||
+            (b==signature_AMD_ebx && c==signature_AMD_ecx && d==signature_AMD_edx);
+        return vendor && __get_cpuid(1,&a,&b,&c,&d) && (c&bit_AVX);
+    }();
+    return sse;
+}
+
+template<class V>
+class atomic_dword{
+    static_assert(sizeof(V)==16,"atomic_dword holds a 16-byte value");
+    struct words{
+        unsigned long long lo,hi;
+    };
+    mutable JSS_ASP_ALIGN_TO(16) words w;
+
+    static words to_words(V const& x)
+    {
+        words w;
+        memcpy(&w,&x,sizeof(w));
+        return w;
+    }
+
+    static V from_words(words const& w)
+    {
+        V x;
+        memcpy(static_cast<void*>(&x),&w,sizeof(x));
+        return x;
+    }
+
+    // Initial guess for a cmpxchg16b loop, the two halves may be torn.
+    words guess() const
+    {
+        words res={__atomic_load_n(&w.lo,__ATOMIC_RELAXED),
+                   __atomic_load_n(&w.hi,__ATOMIC_RELAXED)};
+        return res;
+    }
+
+    // If w equals expected store desired, else load w into expected. Always
+    // a full barrier.
+    bool cas(words& expected,words const& desired) const
+    {
+        bool ok;
+        __asm__ __volatile__(
+            "lock cmpxchg16b %1\n\t"
+            "sete %0"
+            :"=q"(ok),"+m"(w),
+             "+a"(expected.lo),"+d"(expected.hi)
+            :"b"(desired.lo),"c"(desired.hi)
+            :"memory","cc");
+        return ok;
+    }
+
+    static std::memory_order failure_order(std::memory_order order)
+    {
+        return order==std::memory_order_acq_rel?std::memory_order_acquire:
+            order==std::memory_order_release?std::memory_order_relaxed:order;
+    }
+
+public:
+    atomic_dword() noexcept:
+        w(to_words(V()))
+    {}
+    atomic_dword(V x) noexcept:
+        w(to_words(x))
+    {}
+    atomic_dword(const atomic_dword&) = delete;
+    atomic_dword& operator=(const atomic_dword&) = delete;
+
+    bool is_lock_free() const noexcept
+    {
+        return has_cmpxchg16b() || __atomic_is_lock_free(sizeof(w),&w);
+    }
+
+    V load(std::memory_order order=std::memory_order_seq_cst) const noexcept
+    {
+        words res={0,0};
+        if(has_atomic_sse_load()){
+            typedef unsigned long long v2du __attribute__((vector_size(16)));
+            v2du r;
+            __asm__ __volatile__("movdqa %1,%0":"=x"(r):"m"(w):"memory");
+            res.lo=r[0];
+            res.hi=r[1];
+        }
+        else if(has_cmpxchg16b())
+            cas(res,res);   // Stores the value it read, or nothing
+        else
+            __atomic_load(&w,&res,order);
+        return from_words(res);
+    }
+
+    V exchange(V x,std::memory_order order=std::memory_order_seq_cst) noexcept
+    {
+        words desired=to_words(x);
+        words res;
+        if(has_cmpxchg16b()){
+            res=guess();
+            while(!cas(res,desired));
+        }
+        else
+            __atomic_exchange(&w,&desired,&res,order);
+        return from_words(res);
+    }
+
+    bool compare_exchange_weak(
+        V& expected,V desired,
+        std::memory_order success_order,
+        std::memory_order failure_order) noexcept
+    {
+        words e=to_words(expected);
+        words d=to_words(desired);
+        bool const ok=has_cmpxchg16b()?cas(e,d):
+            __atomic_compare_exchange(&w,&e,&d,true,success_order,failure_order);
+        if(!ok)
+            expected=from_words(e);
+        return ok;
+    }
+
+    bool compare_exchange_weak(
+        V& expected,V desired,
+        std::memory_order order=std::memory_order_seq_cst) noexcept
+    {
+        return compare_exchange_weak(expected,desired,order,failure_order(order));
+    }
+};
 #else
-#define JSS_ASP_ALIGN_TO(alignment) __attribute__((aligned(alignment)))
-#ifdef __LP64__
-#define JSS_ASP_BITFIELD_SIZE 32
-#else
-#define JSS_ASP_BITFIELD_SIZE 16
-#endif
+template<class V>
+using atomic_dword=std::atomic<V>;
 #endif
 
 template <class T>
@@ -728,10 +986,10 @@ class atomic_shared_ptr
         {}
     };
 
-    mutable JSS_ASP_ALIGN_TO(sizeof(counted_ptr)) std::atomic<counted_ptr> p;
+    mutable JSS_ASP_ALIGN_TO(sizeof(counted_ptr)) atomic_dword<counted_ptr> p;
 
     struct local_access{
-        std::atomic<counted_ptr>& p;
+        atomic_dword<counted_ptr>& p;
         counted_ptr val;
 
         void acquire(std::memory_order order){
@@ -747,7 +1005,7 @@ class atomic_shared_ptr
         }
         
         local_access(
-            std::atomic<counted_ptr>& p_,
+            atomic_dword<counted_ptr>& p_,
             std::memory_order order=std::memory_order_relaxed):
             p(p_),val(p.load(order))
         {
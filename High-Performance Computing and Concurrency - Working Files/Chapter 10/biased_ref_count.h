@@ -0,0 +1,166 @@
+#ifndef INCLUDED_BIASED_REF_COUNT_H_
+#define INCLUDED_BIASED_REF_COUNT_H_
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Biased reference counter for objects used mostly by one thread, provides the
+// AddRef()/DelRef() interface required by intr_shared_ptr:
+//   struct my_type : public biased_ref_count<my_type> { ... };
+//
+// The thread that adds the first reference owns the object and counts its
+// references with a non-atomic counter, other threads count theirs with an
+// atomic shared counter. The object is deleted when the sum drops to 0:
+// - when the owner's count drops to 0, the owner merges it into the shared
+//   counter, from then on all threads use the shared counter;
+// - when another thread drops the shared counter below 0 (it released a
+//   reference counted by the owner), it queues the object to the owner. The
+//   owner merges the counters of the queued objects, and deletes them if they
+//   are no longer referenced, in merge_queued() or when the owner thread
+//   exits. After the owner exited, the queueing thread merges the counters.
+// An owner thread that hands off references to other threads and runs for a
+// long time should call merge_queued() periodically.
+// The first reference must be added before the object is shared with other
+// threads (this is always true for objects created with new and then handed to
+// intr_shared_ptr).
+class biased_ref_count_base
+{
+  // Per-thread owner record. Records are never deleted, so an exited owner is
+  // never confused with a new thread; they are linked in a global list, which
+  // costs one small record per thread that ever owned an object.
+  struct owner {
+    owner() : alive(true), next(nullptr) {}
+    std::mutex lock;
+    bool alive;
+    std::vector<biased_ref_count_base*> queued;
+    owner* next;
+  };
+  static owner* new_owner() {
+    static std::atomic<owner*> all_owners(nullptr);
+    owner* const o = new owner;
+    o->next = all_owners.load(std::memory_order_relaxed);
+    while (!all_owners.compare_exchange_weak(o->next, o, std::memory_order_release, std::memory_order_relaxed)) {}
+    return o;
+  }
+  struct owner_holder {
+    owner_holder() : o(new_owner()) {}
+    ~owner_holder() {
+      std::vector<biased_ref_count_base*> q;
+      {
+        std::lock_guard<std::mutex> l(o->lock);
+        o->alive = false;
+        q.swap(o->queued);
+      }
+      merge_all(q);
+    }
+    owner* const o;
+  };
+  static owner* this_owner() {
+    static thread_local owner_holder h;
+    return h.o;
+  }
+
+  // The shared counter holds the count shifted by 2 and two flags:
+  // merged - the owner's count was merged, queued - queued to the owner.
+  static const int64_t merged_bit = 1;
+  static const int64_t queued_bit = 2;
+  static const int64_t one = 4;
+
+  public:
+  void AddRef() {
+    owner* const me = this_owner();
+    if (owner_ == me && !merged_) {
+      ++biased_;
+    } else if (owner_ == nullptr) {   // First reference, not shared yet
+      owner_ = me;
+      biased_ = 1;
+    } else {
+      shared_.fetch_add(one, std::memory_order_relaxed);
+    }
+  }
+  bool DelRef() {
+    if (owner_ == this_owner() && !merged_) {
+      if (--biased_ != 0) return false;
+      merged_ = true;
+      // Deleted here unless queued, then merge_queued() deletes it.
+      return shared_.fetch_add(merged_bit, std::memory_order_acq_rel) + merged_bit == merged_bit;
+    }
+    int64_t v = shared_.load(std::memory_order_relaxed);
+    int64_t nv;
+    do {
+      nv = v - one;
+      if ((v & (merged_bit | queued_bit)) == 0 && nv < 0) nv |= queued_bit;
+    } while (!shared_.compare_exchange_weak(v, nv, std::memory_order_acq_rel, std::memory_order_relaxed));
+    if (nv == merged_bit) return true;
+    if ((nv & queued_bit) && !(v & queued_bit)) queue_to_owner();
+    return false;
+  }
+
+  // Merge the counters of the objects owned by the calling thread that were
+  // queued by other threads, delete the objects that are no longer referenced.
+  static void merge_queued() {
+    owner* const me = this_owner();
+    std::vector<biased_ref_count_base*> q;
+    {
+      std::lock_guard<std::mutex> l(me->lock);
+      q.swap(me->queued);
+    }
+    merge_all(q);
+  }
+
+  protected:
+  typedef void (*destroy_t)(biased_ref_count_base*);
+  explicit biased_ref_count_base(destroy_t destroy) : owner_(nullptr), biased_(0), merged_(false), shared_(0), destroy_(destroy) {}
+  ~biased_ref_count_base() {}
+  biased_ref_count_base(const biased_ref_count_base& x) = delete;
+  biased_ref_count_base& operator=(const biased_ref_count_base& x) = delete;
+
+  private:
+  void queue_to_owner() {
+    {
+      std::lock_guard<std::mutex> l(owner_->lock);
+      if (owner_->alive) {
+        owner_->queued.push_back(this);
+        return;
+      }
+    }
+    if (merge()) destroy_(this);
+  }
+  // Called by the owner, or by the thread that queued the object after the
+  // owner exited. Returns true if the object is no longer referenced.
+  bool merge() {
+    int64_t add = -queued_bit;
+    if (!merged_) {
+      add += biased_*one + merged_bit;
+      biased_ = 0;
+      merged_ = true;
+    }
+    return shared_.fetch_add(add, std::memory_order_acq_rel) + add == merged_bit;
+  }
+  static void merge_all(const std::vector<biased_ref_count_base*>& q) {
+    for (biased_ref_count_base* p : q) {
+      if (p->merge()) p->destroy_(p);
+    }
+  }
+
+  owner* owner_;                    // Set by the first AddRef()
+  int64_t biased_;                  // Used only by the owner
+  bool merged_;                     // Used only by the owner
+  std::atomic<int64_t> shared_;
+  const destroy_t destroy_;
+};
+
+template <typename T> class biased_ref_count : public biased_ref_count_base
+{
+  protected:
+  biased_ref_count() : biased_ref_count_base(&destroy) {}
+  ~biased_ref_count() {}
+
+  private:
+  static void destroy(biased_ref_count_base* p) {
+    delete static_cast<T*>(static_cast<biased_ref_count*>(p));
+  }
+};
+
+#endif // INCLUDED_BIASED_REF_COUNT_H_
@@ -0,0 +1,115 @@
+#ifndef INCLUDED_DEFERRED_REF_COUNT_H_
+#define INCLUDED_DEFERRED_REF_COUNT_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Reference counter with deferred decrements, provides the AddRef()/DelRef()
+// interface required by intr_shared_ptr:
+//   struct my_type : public deferred_ref_count<my_type> { ... };
+//
+// DelRef() does not decrement the counter, it records the decrement in a
+// per-thread log and never returns true. The log has one slot per object, and
+// the decrements of the same object are coalesced in its slot. AddRef() of an
+// object with a pending decrement in the log of the calling thread cancels the
+// decrement instead of incrementing the counter, so a short-lived handle to a
+// hot object, such as the handles created during list traversal, costs no
+// atomic operations on the counter after the first one.
+// The pending decrements of an object are applied with a single atomic
+// subtraction when its slot is needed for another object, when flush() is
+// called, and when the thread exits. The objects are deleted then, if the
+// counter drops to 0. A thread that holds on to the last reference to many
+// objects, or stops releasing references for a long time, should call flush().
+class deferred_ref_count_base
+{
+  struct entry {
+    deferred_ref_count_base* p;
+    unsigned long n;        // Pending decrements of p
+  };
+  static const size_t log_size = 64;
+  struct log {
+    log() {
+      for (size_t i = 0; i != log_size; ++i) e[i].p = nullptr, e[i].n = 0;
+    }
+    ~log() { flush(); }
+    entry e[log_size];
+  };
+  static log& this_log() {
+    static thread_local log l;
+    return l;
+  }
+  entry& slot() {
+    const uintptr_t x = reinterpret_cast<uintptr_t>(this);
+    return this_log().e[((x >> 4) ^ (x >> 10)) & (log_size - 1)];
+  }
+
+  public:
+  void AddRef() {
+    entry& e = slot();
+    if (e.p == this) {      // Cancel a pending decrement
+      if (--e.n == 0) e.p = nullptr;
+      return;
+    }
+    ref_cnt_.fetch_add(1, std::memory_order_relaxed);
+  }
+  bool DelRef() {
+    entry& e = slot();
+    if (e.p == this) {
+      ++e.n;
+      return false;
+    }
+    // Take the slot before applying the decrements of its last object: the
+    // object may be deleted, and its destructor may release more references.
+    const entry old = e;
+    e.p = this;
+    e.n = 1;
+    if (old.p) old.p->apply(old.n);
+    return false;
+  }
+  // Apply all pending decrements of the calling thread.
+  static void flush() {
+    log& l = this_log();
+    for (bool again = true; again; ) {
+      again = false;
+      for (size_t i = 0; i != log_size; ++i) {
+        const entry old = l.e[i];
+        if (!old.p) continue;
+        l.e[i].p = nullptr;
+        l.e[i].n = 0;
+        old.p->apply(old.n);    // May add more pending decrements
+        again = true;
+      }
+    }
+  }
+  // The counter without the pending decrements, for tests and debugging.
+  unsigned long ref_count() const { return ref_cnt_.load(std::memory_order_relaxed); }
+
+  protected:
+  typedef void (*destroy_t)(deferred_ref_count_base*);
+  explicit deferred_ref_count_base(destroy_t destroy) : ref_cnt_(0), destroy_(destroy) {}
+  ~deferred_ref_count_base() {}
+  deferred_ref_count_base(const deferred_ref_count_base& x) = delete;
+  deferred_ref_count_base& operator=(const deferred_ref_count_base& x) = delete;
+
+  private:
+  void apply(unsigned long n) {
+    if (ref_cnt_.fetch_sub(n, std::memory_order_acq_rel) == n) destroy_(this);
+  }
+
+  std::atomic<unsigned long> ref_cnt_;
+  const destroy_t destroy_;
+};
+
+template <typename T> class deferred_ref_count : public deferred_ref_count_base
+{
+  protected:
+  deferred_ref_count() : deferred_ref_count_base(&destroy) {}
+  ~deferred_ref_count() {}
+
+  private:
+  static void destroy(deferred_ref_count_base* p) {
+    delete static_cast<T*>(static_cast<deferred_ref_count*>(p));
+  }
+};
+
+#endif // INCLUDED_DEFERRED_REF_COUNT_H_
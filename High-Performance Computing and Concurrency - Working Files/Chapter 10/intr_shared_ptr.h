@@ -1,8 +1,10 @@
 #ifndef INCLUDED_INTR_SHARED_PTR_H_
 #define INCLUDED_INTR_SHARED_PTR_H_
+#include <assert.h>
+#include <stdint.h>
 #include <cstdlib>
-#include <time.h>
 #include <atomic>
+#include <utility>
 
 // Intrusive reference-counted pointer:
 // T - type the pointer points to
@@ -11,25 +13,100 @@
 //     void AddRef() - atomically increment reference count by 1
 //     bool DelRef() - atomically decrement reference count by 1, return true iff the counter dropped to 0
 //     operator T&(), operator const T&() const - conversions to T (implicit if U is derived from T)
+//
+// The pointer is lock-free, it uses split reference counts: the upper 16 bits
+// of the pointer word hold a local count of threads that are reading the
+// pointer. A reader increments the local count together with loading the
+// pointer (a single fetch_add on the word), which keeps the object alive
+// while the reader increments its reference count. Then the reader returns
+// its local count: decrements it if the pointer is unchanged, otherwise the
+// writer that replaced the pointer has added the local count to the reference
+// count of the old object before replacing it, and the reader decrements the
+// reference count instead.
+// Requires user-space pointers to fit in 48 bits (x86-64, AArch64).
 template <typename T, typename U = T> class intr_shared_ptr
 {
-  struct get_ptr {
-    std::atomic<U*>& aptr;
-    U* p;
-    get_ptr(std::atomic<U*>& ptr) : aptr(ptr), p() {
-      static const timespec ns = { 0, 1 };
-      for (register int i = 0; aptr.load(std::memory_order_relaxed) == (U*)(locked) || (p = aptr.exchange((U*)(locked), std::memory_order_acquire)) == (U*)(locked); ++i) {
-        if (i == 8) {
-          i = 0;
-          nanosleep(&ns, NULL);
+  static_assert(sizeof(U*) == sizeof(uint64_t), "intr_shared_ptr requires 64-bit pointers");
+  static const int count_shift = 48;
+  static const uint64_t count_one = uint64_t(1) << count_shift;
+  static const uint64_t ptr_mask = count_one - 1;
+  static U* ptr(uint64_t w) { return reinterpret_cast<U*>(w & ptr_mask); }
+  static uint64_t count(uint64_t w) { return w >> count_shift; }
+  static uint64_t word(U* p) {
+    const uint64_t w = reinterpret_cast<uintptr_t>(p);
+    assert((w & ~ptr_mask) == 0);
+    return w;
+  }
+  static void add_refs(U* p, uint64_t n) {
+    for (; n != 0; --n) p->AddRef();
+  }
+  static void del_refs(U* p, uint64_t n) {
+    for (; n != 0; --n) p->DelRef();
+  }
+
+  // Increment the local count, the object the returned word points to stays
+  // alive until the local count is returned by unborrow().
+  static uint64_t borrow(std::atomic<uint64_t>& aw) {
+    return aw.fetch_add(count_one, std::memory_order_acquire) + count_one;
+  }
+  // Returns false if the pointer was replaced, then the local count was
+  // transferred to the reference count of the object, and the caller must
+  // decrement that instead.
+  static bool unborrow(std::atomic<uint64_t>& aw, uint64_t w) {
+    U* const p = ptr(w);
+    while (ptr(w) == p && count(w) != 0) {
+      if (aw.compare_exchange_weak(w, w - count_one, std::memory_order_release, std::memory_order_relaxed)) return true;
+    }
+    return false;
+  }
+  // Replace the local count added by borrow() with a reference.
+  static U* hold(std::atomic<uint64_t>& aw, uint64_t w) {
+    U* const p = ptr(w);
+    if (p) {
+      p->AddRef();
+      if (!unborrow(aw, w)) p->DelRef();  // Never drops to 0, we hold a reference
+    }
+    return p;
+  }
+  // Load the pointer and add a reference to it.
+  static U* acquire(std::atomic<uint64_t>& aw) {
+    return hold(aw, borrow(aw));
+  }
+  // Replace the pointer with p (p must hold a reference for the pointer) if
+  // the current pointer is expected, or unconditionally if any is true.
+  // On success, returns true and the old pointer in old, with the reference
+  // that was held by the pointer. Otherwise, returns false and the current
+  // pointer in old, with a new reference.
+  static bool replace(std::atomic<uint64_t>& aw, U* p, bool any, U* expected, U*& old) {
+    while (true) {
+      uint64_t w = borrow(aw);
+      U* const q = ptr(w);
+      if (!any && q != expected) {
+        old = hold(aw, w);
+        return false;
+      }
+      // Transfer the local count to q before replacing it, except our own.
+      // The count may be 0 if another reader returned our count after the
+      // pointer was replaced and set to q again, then we return it to q.
+      while (ptr(w) == q) {
+        const uint64_t n = count(w) ? count(w) - 1 : 0;
+        if (q) add_refs(q, n);
+        if (aw.compare_exchange_weak(w, word(p), std::memory_order_acq_rel, std::memory_order_relaxed)) {
+          if (q && count(w) == 0) q->DelRef();  // Never drops to 0, the pointer held a reference
+          old = q;
+          return true;
         }
+        if (q) del_refs(q, n);  // Never drops to 0, we hold a local count
       }
+      // q was replaced by another thread, which transferred our local count.
+      drop(q);
     }
-    ~get_ptr() {
-      aptr.store(p, std::memory_order_release);
+  }
+  static void drop(U* p) {
+    if (p && p->DelRef()) {
+      delete p;
     }
-    static const uintptr_t locked = uintptr_t(-1);
-  };
+  }
 
   public:
   // Non-threadsafe shared pointer, used to hold non-zero reference counter to
@@ -43,6 +120,10 @@ template <typename T, typename U = T> class intr_shared_ptr
     shared_ptr(const shared_ptr& x) : p_(x.p_) {
       if (p_) p_->AddRef();
     }
+    // Moves transfer the reference without touching the reference count.
+    shared_ptr(shared_ptr&& x) noexcept : p_(x.p_) {
+      x.p_ = nullptr;
+    }
     ~shared_ptr() {
       if (p_ && p_->DelRef()) {
         delete p_;
@@ -58,6 +139,19 @@ template <typename T, typename U = T> class intr_shared_ptr
       if (p_) p_->AddRef();
       return *this;
     }
+    shared_ptr& operator=(shared_ptr&& x) {
+      if (this == &x) return *this;
+      adopt(x.p_);
+      x.p_ = nullptr;
+      return *this;
+    }
+    // Reset the handle and return the pointer without changing its reference
+    // count: the caller takes over the reference.
+    U* release() {
+      U* const p = p_;
+      p_ = nullptr;
+      return p;
+    }
     bool operator==(const shared_ptr& rhs) const {
         return p_ == rhs.p_;
     }
@@ -67,114 +161,124 @@ template <typename T, typename U = T> class intr_shared_ptr
 
     private:
     friend class intr_shared_ptr;
-    explicit shared_ptr(U* p) : p_(p) {
-      if (p_) p_->AddRef();
+    explicit shared_ptr(U* p, bool add_ref = true) : p_(p) {
+      if (p_ && add_ref) p_->AddRef();
     }
-    void reset(U* p) {
-      if (p_ == p) return;
+    // Take over the reference to p held by the caller.
+    void adopt(U* p) {
       if (p_ && p_->DelRef()) {
         delete p_;
       }
       p_ = p;
-      if (p_) p_->AddRef();
     }
     U* p_;
   };
 
-  explicit intr_shared_ptr(U* p = NULL) : p_(p) {
+  explicit intr_shared_ptr(U* p = NULL) : w_(word(p)) {
     if (p) p->AddRef();
   }
-  explicit intr_shared_ptr(const shared_ptr& x) : p_() {
+  explicit intr_shared_ptr(const shared_ptr& x) : w_(word(x.p_)) {
     if (x.p_) x.p_->AddRef();
-    p_.store(x.p_, std::memory_order_relaxed);
   }
-  explicit intr_shared_ptr(const intr_shared_ptr& x) : p_() {
-    get_ptr px(x.p_);
-    if (px.p) px.p->AddRef();
-    p_.store(px.p, std::memory_order_relaxed);
+  explicit intr_shared_ptr(shared_ptr&& x) : w_(word(x.release())) {
+  }
+  explicit intr_shared_ptr(const intr_shared_ptr& x) : w_(word(acquire(x.w_))) {
+  }
+  // x must not be accessed concurrently with the move, except by reading.
+  intr_shared_ptr(intr_shared_ptr&& x) : w_(word(x.release())) {
   }
   ~intr_shared_ptr() {
-    get_ptr p(p_);
-    if (p.p && p.p->DelRef()) {
-      delete p.p;
-    }
-    p.p = NULL; // Destructor of p will copy this to p_
+    drop(ptr(w_.load(std::memory_order_acquire)));
   }
   intr_shared_ptr& operator=(const intr_shared_ptr& x) {
     if (this == &x) return *this;
-    // Beware of a deadlock:
-    // get_ptr px(x.p_);
-    // get_ptr p(p_);
-    // Deadlock will happen if a = b; and b = a; are executed at the same time.
-    U* pxp;
-    {
-      get_ptr px(x.p_);
-      pxp = px.p;
-      if (px.p) px.p->AddRef();
-    }
-    get_ptr p(p_);
-    if (p.p && p.p->DelRef()) {
-      delete p.p;
-    }
-    p.p = pxp;  // Destructor of p will copy this to p_
+    U* old;
+    replace(w_, acquire(x.w_), true, NULL, old);
+    drop(old);
+    return *this;
+  }
+  intr_shared_ptr& operator=(intr_shared_ptr&& x) {
+    if (this == &x) return *this;
+    U* old;
+    replace(w_, x.release(), true, NULL, old);
+    drop(old);
     return *this;
   }
   void reset(U* x) {
-    get_ptr p(p_);
-    if (p.p == x) return;
-    if (p.p && p.p->DelRef()) {
-      delete p.p;
-    }
-    p.p = x;  // Destructor of p will copy this to p_
     if (x) x->AddRef();
+    U* old;
+    replace(w_, x, true, NULL, old);
+    drop(old);
   }
   void reset(const shared_ptr& x) {
-    get_ptr p(p_);
-    if (p.p == x.p_) return;
-    if (p.p && p.p->DelRef()) {
-      delete p.p;
-    }
-    p.p = x.p_;  // Destructor of p will copy this to p_
-    if (x.p_) x.p_->AddRef();
+    reset(x.p_);
   }
-  explicit operator bool() const { return p_.load(std::memory_order_relaxed) != NULL; }
+  void reset(shared_ptr&& x) {
+    U* old;
+    replace(w_, x.release(), true, NULL, old);
+    drop(old);
+  }
+  // Replace the pointer with x and return the old value, the reference held
+  // by the pointer is moved into the returned handle.
+  shared_ptr exchange(U* x) {
+    if (x) x->AddRef();
+    U* old;
+    replace(w_, x, true, NULL, old);
+    return shared_ptr(old, false);
+  }
+  shared_ptr exchange(const shared_ptr& x) {
+    return exchange(x.p_);
+  }
+  shared_ptr exchange(shared_ptr&& x) {
+    U* old;
+    replace(w_, x.release(), true, NULL, old);
+    return shared_ptr(old, false);
+  }
+  // Set the pointer to NULL and return the old value without changing its
+  // reference count: the caller takes over the reference.
+  U* release() {
+    U* old;
+    replace(w_, NULL, true, NULL, old);
+    return old;
+  }
+  explicit operator bool() const { return ptr(w_.load(std::memory_order_relaxed)) != NULL; }
 
   shared_ptr get() const {
-    get_ptr p(p_);
-    return shared_ptr(p.p);
+    return shared_ptr(acquire(w_), false);
   }
 
   bool compare_exchange_strong(shared_ptr& expected_ptr, const shared_ptr& new_ptr) {
-    get_ptr p(p_);
-    if (p.p == expected_ptr.p_) {
-      if (p.p && p.p->DelRef()) {
-        delete p.p;
-      }
-      p.p = new_ptr.p_;  // Destructor of p will copy this to p_
-      if (p.p) p.p->AddRef();
+    return compare_exchange_strong(expected_ptr, new_ptr.p_);
+  }
+
+  // On success, the reference held by new_ptr is moved into the pointer and
+  // new_ptr is reset, on failure new_ptr is unchanged.
+  bool compare_exchange_strong(shared_ptr& expected_ptr, shared_ptr&& new_ptr) {
+    U* old;
+    if (replace(w_, new_ptr.p_, false, expected_ptr.p_, old)) {
+      new_ptr.p_ = nullptr;
+      drop(old);
       return true;
-    } else {
-      expected_ptr.reset(p.p);
-      return false;
     }
+    expected_ptr.adopt(old);
+    return false;
   }
 
   bool compare_exchange_strong(shared_ptr& expected_ptr, U* new_ptr) {
-    get_ptr p(p_);
-    if (p.p == expected_ptr.p_) {
-      if (p.p && p.p->DelRef()) {
-        delete p.p;
-      }
-      p.p = new_ptr;  // Destructor of p will copy this to p_
-      if (p.p) p.p->AddRef();
+    if (new_ptr) new_ptr->AddRef();
+    U* old;
+    if (replace(w_, new_ptr, false, expected_ptr.p_, old)) {
+      drop(old);
       return true;
-    } else {
-      expected_ptr.reset(p.p);
-      return false;
     }
+    // Never drops to 0 if new_ptr is held by a shared_ptr, otherwise the
+    // caller still owns new_ptr.
+    if (new_ptr) new_ptr->DelRef();
+    expected_ptr.adopt(old);
+    return false;
   }
 
   private:
-  mutable std::atomic<U*> p_;
+  mutable std::atomic<uint64_t> w_;
 };
 #endif // INCLUDED_INTR_SHARED_PTR_H_
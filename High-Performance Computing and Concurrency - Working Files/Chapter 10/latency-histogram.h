@@ -0,0 +1,162 @@
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include <istream>
+#include <ostream>
+#include <string>
+
+// Log-linear (HDR-style) histogram of latencies, usually in TSC cycles.
+// Values below 2^kSubBucketBits are counted exactly, larger values are
+// counted in buckets that split each power of two into 2^(kSubBucketBits-1)
+// equal parts, so the relative error of any reported value is below
+// 2^(1-kSubBucketBits), or 1.6%. Recording is a few instructions and does no
+// synchronization: each thread records into its own histogram, and the
+// histograms are merged when the threads are done.
+//
+// Example:
+//   LatencyHistogram H;                       // One per thread
+//   for (...) {
+//     ScopedLatency<FastTSCTimer> L(H);      // Records when destroyed
+//     ... timed code ...
+//   }
+//   ... after the threads are joined ...
+//   Total.Merge(H);
+//   cout << "p99: " << Total.Percentile(99)*T.ClockCycle() << " ns" << endl;
+class LatencyHistogram
+{
+    public:
+    static const int kSubBucketBits = 7;
+    static const int kHalfBucket = 1 << (kSubBucketBits - 1);
+    static const int kNumBuckets = (64 - kSubBucketBits + 2)*kHalfBucket;
+
+    LatencyHistogram() { Reset(); }
+
+    void Reset() {
+        memset(counts_, 0, sizeof(counts_));
+        count_ = 0;
+        sum_ = 0;
+        min_ = ~uint64_t(0);
+        max_ = 0;
+    }
+
+    // Record one value.
+    void Record(uint64_t value) {
+        ++counts_[Index(value)];
+        ++count_;
+        sum_ += value;
+        if (value < min_) min_ = value;
+        if (value > max_) max_ = value;
+    }
+
+    // Add the values recorded in another histogram to this one.
+    void Merge(const LatencyHistogram& rhs) {
+        for (int i = 0; i < kNumBuckets; ++i) counts_[i] += rhs.counts_[i];
+        count_ += rhs.count_;
+        sum_ += rhs.sum_;
+        if (rhs.min_ < min_) min_ = rhs.min_;
+        if (rhs.max_ > max_) max_ = rhs.max_;
+    }
+
+    uint64_t Count() const { return count_; }
+    uint64_t Min() const { return count_ ? min_ : 0; }
+    uint64_t Max() const { return max_; }
+    double Mean() const { return count_ ? double(sum_)/count_ : 0; }
+
+    // Value at or below which the given percentage (0 to 100) of the recorded
+    // values lie. The value returned is the largest value in its bucket, so
+    // it may be above the true value by the relative error of the histogram,
+    // but never above Max().
+    uint64_t Percentile(double percent) const {
+        if (count_ == 0) return 0;
+        if (percent <= 0) return min_;
+        uint64_t rank = uint64_t(percent/100*count_ + 0.5);
+        if (rank == 0) rank = 1;
+        if (rank >= count_) return max_;
+        uint64_t seen = 0;
+        for (int i = 0; i < kNumBuckets; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                uint64_t v = HighestValue(i);
+                return v < max_ ? v : max_;
+            }
+        }
+        return max_;
+    }
+
+    // Write the histogram as one line of text: a header, the totals, and
+    // the non-empty buckets as index:count pairs.
+    void Serialize(std::ostream& out) const {
+        out << "LatencyHistogram " << kSubBucketBits << " " << count_ << " " << sum_ << " " << Min() << " " << max_;
+        for (int i = 0; i < kNumBuckets; ++i) {
+            if (counts_[i]) out << " " << i << ":" << counts_[i];
+        }
+        out << "\n";
+    }
+
+    // Read a histogram written by Serialize(), return false if the input is
+    // not a histogram with the same bucket layout. The values are merged with
+    // the values already in the histogram.
+    bool Deserialize(std::istream& in) {
+        std::string tag;
+        int sub_bucket_bits;
+        LatencyHistogram h;
+        uint64_t min;
+        if (!(in >> tag >> sub_bucket_bits >> h.count_ >> h.sum_ >> min >> h.max_)) return false;
+        if (tag != "LatencyHistogram" || sub_bucket_bits != kSubBucketBits) return false;
+        if (h.count_) h.min_ = min;
+        uint64_t total = 0;
+        while (in.peek() == ' ') {
+            int i;
+            char colon;
+            uint64_t n;
+            if (!(in >> i >> colon >> n) || colon != ':' || i < 0 || i >= kNumBuckets) return false;
+            h.counts_[i] += n;
+            total += n;
+        }
+        if (total != h.count_) return false;
+        Merge(h);
+        return true;
+    }
+
+    // Bucket of a value: the values below 2^kSubBucketBits have their own
+    // buckets, then each range [2^e, 2^(e+1)) has kHalfBucket buckets.
+    static int Index(uint64_t value) {
+        if (value < (uint64_t(1) << kSubBucketBits)) return int(value);
+        const int shift = 63 - __builtin_clzll(value) - (kSubBucketBits - 1);
+        return shift*kHalfBucket + int(value >> shift);
+    }
+
+    // The largest value counted in a bucket.
+    static uint64_t HighestValue(int index) {
+        if (index < (1 << kSubBucketBits)) return index;
+        const int shift = index/kHalfBucket - 1;
+        const uint64_t top = index - shift*kHalfBucket;
+        return ((top + 1) << shift) - 1;
+    }
+
+    private:
+    uint64_t counts_[kNumBuckets];
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t min_;
+    uint64_t max_;
+};
+
+// Records the time between its construction and destruction into a
+// histogram. Timer is one of the TSC timers (see tsc-timer.h), or any class
+// with Start() and Stop() methods.
+template <typename Timer> class ScopedLatency
+{
+    public:
+    explicit ScopedLatency(LatencyHistogram& h) : h_(h) { T_.Start(); }
+    ~ScopedLatency() { h_.Record(T_.Stop()); }
+
+    private:
+    LatencyHistogram& h_;
+    Timer T_;
+};
+
+#endif // LATENCY_HISTOGRAM_H_
@@ -0,0 +1,76 @@
+// Benchmarks for concurrent ordered maps: the map m must be defined before
+// this file is included, and support insert(k, v), erase(k), find(k),
+// count_range(lo, hi) and clear().
+
+static const int Nmap = 1000;
+// The map holds even keys from 0 to 2*Nmap, inserts and erases use odd keys.
+void Prep() {
+  m.clear();
+  for (int i = 0; i < Nmap; ++i) m.insert(2*i, i);
+}
+
+void BM_find(benchmark::State& state) {
+  if (state.thread_index == 0) Prep();
+  int k = 2*state.thread_index;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(m.find(k));
+    k = (k + 2*17) % (2*Nmap);
+  }
+}
+
+void BM_insert_erase(benchmark::State& state) {
+  if (state.thread_index == 0) Prep();
+  int k = 2*state.thread_index + 1;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(m.insert(k, k));
+    benchmark::DoNotOptimize(m.erase(k));
+    k = (k + 2*17) % (2*Nmap);
+  }
+}
+
+static const int Nrange = 32;
+void BM_range(benchmark::State& state) {
+  if (state.thread_index == 0) Prep();
+  int k = 2*state.thread_index;
+  while (state.KeepRunning()) {
+    benchmark::DoNotOptimize(m.count_range(k, k + Nrange));
+    k = (k + 2*17) % (2*Nmap);
+  }
+}
+
+// 90% lookups, 10% inserts and erases.
+void BM_mixed(benchmark::State& state) {
+  if (state.thread_index == 0) Prep();
+  int k = state.thread_index;
+  int i = 0;
+  while (state.KeepRunning()) {
+    if (++i == 10) {
+      i = 0;
+      if (k & 1) benchmark::DoNotOptimize(m.insert(k, k));
+      else benchmark::DoNotOptimize(m.erase(k - 1));
+    } else {
+      benchmark::DoNotOptimize(m.find(k));
+    }
+    k = (k + 17) % (2*Nmap);
+  }
+}
+
+#define ALL_BENCHMARKS(N) \
+BENCHMARK(BM_find) ARGS(N); \
+BENCHMARK(BM_insert_erase) ARGS(N); \
+BENCHMARK(BM_range) ARGS(N); \
+BENCHMARK(BM_mixed) ARGS(N); \
+struct dummy##N {}
+
+ALL_BENCHMARKS(1);
+ALL_BENCHMARKS(2);
+ALL_BENCHMARKS(4);
+ALL_BENCHMARKS(8);
+ALL_BENCHMARKS(16);
+ALL_BENCHMARKS(32);
+ALL_BENCHMARKS(64);
+ALL_BENCHMARKS(80);
+ALL_BENCHMARKS(120);
+ALL_BENCHMARKS(128);
+
+BENCHMARK_MAIN()
@@ -0,0 +1,133 @@
+#ifndef INCLUDED_POOL_ALLOCATOR_H_
+#define INCLUDED_POOL_ALLOCATOR_H_
+#include <stddef.h>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Pool of fixed-size memory blocks with per-thread caches.
+//
+// Each thread allocates from and frees to its own free list without locking
+// or atomic operations. A thread that frees more blocks than it allocates
+// returns them to the central free list in batches, a thread that runs out of
+// blocks takes a batch from the central list, or carves a new slab of blocks.
+// Slabs are never returned to the system. The cache of a thread is returned to
+// the central list when the thread exits.
+template <size_t Size> class block_pool
+{
+  static_assert(Size % alignof(max_align_t) == 0, "Block size must be a multiple of the maximum alignment");
+  struct block {
+    block* next;
+  };
+  static const size_t batch = 64;
+  static const size_t max_cached = 2*batch;
+
+  struct central {
+    central() : free(nullptr) {}
+    std::mutex lock;
+    block* free;
+    std::vector<void*> slabs;   // Kept only to show the memory is in use
+  };
+  static central& this_central() {
+    static central* c = new central;
+    return *c;
+  }
+  struct cache {
+    cache() : free(nullptr), count(0) {}
+    ~cache() { release(*this, count); }
+    block* free;
+    size_t count;
+  };
+  static cache& this_cache() {
+    static thread_local cache t;
+    return t;
+  }
+
+  // Move up to batch blocks from the central list to the cache of the thread,
+  // carve a new slab if the central list is empty.
+  static void refill(cache& t) {
+    central& c = this_central();
+    {
+      std::lock_guard<std::mutex> l(c.lock);
+      for (; c.free && t.count != batch; ++t.count) {
+        block* const b = c.free;
+        c.free = b->next;
+        b->next = t.free;
+        t.free = b;
+      }
+    }
+    if (t.free) return;
+    char* const slab = static_cast<char*>(::operator new(batch*Size));
+    for (size_t i = 0; i != batch; ++i) {
+      block* const b = reinterpret_cast<block*>(slab + i*Size);
+      b->next = t.free;
+      t.free = b;
+    }
+    t.count = batch;
+    std::lock_guard<std::mutex> l(c.lock);
+    c.slabs.push_back(slab);
+  }
+  // Move n blocks from the cache of the thread to the central list.
+  static void release(cache& t, size_t n) {
+    if (n == 0) return;
+    block* const first = t.free;
+    block* last = first;
+    for (size_t i = 1; i != n; ++i) last = last->next;
+    t.free = last->next;
+    t.count -= n;
+    central& c = this_central();
+    std::lock_guard<std::mutex> l(c.lock);
+    last->next = c.free;
+    c.free = first;
+  }
+
+  public:
+  static void* allocate() {
+    cache& t = this_cache();
+    if (!t.free) refill(t);
+    block* const b = t.free;
+    t.free = b->next;
+    --t.count;
+    return b;
+  }
+  static void deallocate(void* p) {
+    cache& t = this_cache();
+    block* const b = static_cast<block*>(p);
+    b->next = t.free;
+    t.free = b;
+    if (++t.count > max_cached) release(t, batch);
+  }
+};
+
+// Standard allocator that allocates single objects from block_pool, for
+// control blocks of shared pointers and other small objects that are created
+// and destroyed often. Arrays are allocated with operator new.
+template <typename T> class pool_allocator
+{
+  // Computed only in the member functions: the allocator may be instantiated
+  // for an incomplete type, such as a node that contains its allocator.
+  static const size_t align = alignof(max_align_t);
+  template <typename U> using pool = block_pool<(sizeof(U) + align - 1)/align*align>;
+
+  public:
+  typedef T value_type;
+  template <typename U> struct rebind { typedef pool_allocator<U> other; };
+
+  pool_allocator() noexcept {}
+  template <typename U> pool_allocator(const pool_allocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    static_assert(alignof(T) <= align, "Over-aligned types are not supported");
+    if (n == 1) return static_cast<T*>(pool<T>::allocate());
+    return static_cast<T*>(::operator new(n*sizeof(T)));
+  }
+  void deallocate(T* p, size_t n) noexcept {
+    if (n == 1) pool<T>::deallocate(p);
+    else ::operator delete(p);
+  }
+};
+
+template <typename T, typename U> bool operator==(const pool_allocator<T>&, const pool_allocator<U>&) { return true; }
+template <typename T, typename U> bool operator!=(const pool_allocator<T>&, const pool_allocator<U>&) { return false; }
+
+#endif // INCLUDED_POOL_ALLOCATOR_H_
@@ -0,0 +1,63 @@
+#ifndef QUEUE_LATENCY_UTILS_H_
+#define QUEUE_LATENCY_UTILS_H_
+
+#include <latency-histogram.h>
+#include <tsc-timer.h>
+
+#include <mutex>
+#include <sstream>
+
+// Latency percentiles for queue benchmarks. Each benchmark thread records the
+// latency of its operations into its own histogram without synchronization.
+// When a thread is done it merges its histogram into the total, and the last
+// thread to finish reports the percentiles in the benchmark label:
+//   void BM_queue_latency(benchmark::State& state) {
+//     queue_latency L(state);
+//     while (state.KeepRunning()) {
+//       ScopedLatency<FastTSCTimer> T(L.histogram());
+//       ... queue operation ...
+//     }
+//   }
+class queue_latency {
+  public:
+  explicit queue_latency(benchmark::State& state) : state_(state) {
+    // Other threads merge only after the first KeepRunning(), which waits
+    // for all threads to start.
+    if (state_.thread_index == 0) {
+      total().Reset();
+      done() = 0;
+    }
+  }
+  ~queue_latency() {
+    std::lock_guard<std::mutex> l(lock());
+    total().Merge(h_);
+    if (++done() != state_.threads) return;
+    const double ns = FastTSCTimer().ClockCycle();
+    std::ostringstream label;
+    label << "p50=" << total().Percentile(50)*ns << "ns"
+          << " p99=" << total().Percentile(99)*ns << "ns"
+          << " p99.9=" << total().Percentile(99.9)*ns << "ns"
+          << " max=" << total().Max()*ns << "ns";
+    state_.SetLabel(label.str());
+  }
+  LatencyHistogram& histogram() { return h_; }
+
+  private:
+  static LatencyHistogram& total() {
+    static LatencyHistogram h;
+    return h;
+  }
+  static int& done() {
+    static int n;
+    return n;
+  }
+  static std::mutex& lock() {
+    static std::mutex m;
+    return m;
+  }
+
+  benchmark::State& state_;
+  LatencyHistogram h_;
+};
+
+#endif // QUEUE_LATENCY_UTILS_H_
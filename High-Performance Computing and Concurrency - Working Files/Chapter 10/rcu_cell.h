@@ -0,0 +1,157 @@
+#ifndef INCLUDED_RCU_CELL_H_
+#define INCLUDED_RCU_CELL_H_
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <thread>
+
+// Registry of the reader threads of all rcu_cell objects.
+//
+// Each reader thread has its own cache-line-sized record where it publishes
+// the epoch in which its read-side critical section started, or 0 when it is
+// not reading. Readers only write their own records, so they never contend
+// with each other. A writer starts a new epoch after it replaces the pointer,
+// then waits for the grace period: until every reader is either outside of a
+// critical section or started it in the new epoch, and therefore sees the new
+// pointer. Then the old value can be deleted.
+class rcu_domain
+{
+  struct alignas(64) reader {
+    reader() : active(0), nesting(0), in_use(true), next(nullptr) {}
+    std::atomic<uint64_t> active;   // Epoch of the current critical section, 0 if none
+    unsigned int nesting;           // Used only by the thread that owns the record
+    std::atomic<bool> in_use;
+    reader* next;
+    static void* operator new(size_t s) {
+      void* p = NULL;
+      if (::posix_memalign(&p, 64, s) != 0) throw std::bad_alloc();
+      return p;
+    }
+    static void operator delete(void* p) { ::free(p); }
+  };
+  // Records are never deleted, records of exited threads are reused.
+  static std::atomic<reader*>& readers() {
+    static std::atomic<reader*> head(nullptr);
+    return head;
+  }
+  static std::atomic<uint64_t>& epoch() {
+    static std::atomic<uint64_t> e(1);
+    return e;
+  }
+  struct reader_holder {
+    reader_holder() : r(claim()) {}
+    ~reader_holder() {
+      assert(r->nesting == 0);
+      r->in_use.store(false, std::memory_order_release);
+    }
+    reader* const r;
+  };
+  static reader* claim() {
+    for (reader* r = readers().load(std::memory_order_acquire); r; r = r->next) {
+      if (!r->in_use.load(std::memory_order_relaxed) && !r->in_use.exchange(true, std::memory_order_acquire)) return r;
+    }
+    reader* const r = new reader;
+    r->next = readers().load(std::memory_order_relaxed);
+    // A writer that does not see the new record must have replaced its
+    // pointers before the first read of this reader.
+    while (!readers().compare_exchange_weak(r->next, r, std::memory_order_seq_cst, std::memory_order_relaxed)) {}
+    return r;
+  }
+  static reader* this_reader() {
+    static thread_local reader_holder h;
+    return h.r;
+  }
+
+  public:
+  // Enter a read-side critical section, critical sections can be nested.
+  static void read_lock() {
+    reader* const r = this_reader();
+    if (r->nesting++ != 0) return;
+    // The pointers must be loaded after the epoch is published, writers check
+    // the epoch after they replace the pointers. The exchange is a full
+    // barrier, it costs the same as a store and a fence.
+    r->active.exchange(epoch().load(std::memory_order_acquire), std::memory_order_seq_cst);
+  }
+  static void read_unlock() {
+    reader* const r = this_reader();
+    assert(r->nesting != 0);
+    if (--r->nesting != 0) return;
+    r->active.store(0, std::memory_order_release);
+  }
+  // Wait until all critical sections that could have seen the values replaced
+  // before the call have ended. Must not be called inside a critical section.
+  static void synchronize() {
+    assert(this_reader()->nesting == 0);
+    const uint64_t e = epoch().fetch_add(1, std::memory_order_seq_cst) + 1;
+    for (reader* r = readers().load(std::memory_order_seq_cst); r; r = r->next) {
+      for (int i = 0; ; ++i) {
+        const uint64_t a = r->active.load(std::memory_order_seq_cst);
+        if (a == 0 || a >= e) break;
+        if (i >= 8) std::this_thread::yield();
+      }
+    }
+  }
+};
+
+// Read-mostly value published by pointer, for configuration data, routing
+// tables and such, that are read very often and updated rarely.
+// Reading is wait-free and does not write any shared memory: read() returns a
+// snapshot, the value it points to stays valid until the snapshot is
+// destroyed, even if the cell is updated in the meantime. A snapshot must be
+// destroyed by the thread that created it, and that thread must not update
+// any rcu_cell while it holds a snapshot.
+// update() replaces the value and deletes the old one after all snapshots
+// that could see it are destroyed.
+template <typename T> class rcu_cell
+{
+  public:
+  explicit rcu_cell(T* p = nullptr) : p_(p) {}
+  ~rcu_cell() {
+    delete p_.load(std::memory_order_relaxed);
+  }
+  rcu_cell(const rcu_cell& x) = delete;
+  rcu_cell& operator=(const rcu_cell& x) = delete;
+
+  class snapshot {
+    public:
+    ~snapshot() {
+      if (active_) rcu_domain::read_unlock();
+    }
+    snapshot(snapshot&& x) noexcept : p_(x.p_), active_(x.active_) {
+      x.active_ = false;
+    }
+    snapshot(const snapshot& x) = delete;
+    snapshot& operator=(const snapshot& x) = delete;
+    const T& operator*() const { return *p_; }
+    const T* operator->() const { return p_; }
+    const T* get() const { return p_; }
+    explicit operator bool() const { return p_ != nullptr; }
+
+    private:
+    friend class rcu_cell;
+    explicit snapshot(const std::atomic<T*>& p) : p_((rcu_domain::read_lock(), p.load(std::memory_order_seq_cst))), active_(true) {}
+    const T* const p_;
+    bool active_;
+  };
+
+  snapshot read() const {
+    return snapshot(p_);
+  }
+
+  // Replace the value with p (the cell takes ownership), delete the old value
+  // after the grace period.
+  void update(T* p) {
+    T* const old = p_.exchange(p, std::memory_order_seq_cst);
+    if (old) {
+      rcu_domain::synchronize();
+      delete old;
+    }
+  }
+
+  private:
+  std::atomic<T*> p_;
+};
+
+#endif // INCLUDED_RCU_CELL_H_
@@ -0,0 +1,232 @@
+#ifndef TSC_TIMER_H_
+#define TSC_TIMER_H_
+
+// Reference: http://download.intel.com/embedded/software/IA/324264.pdf
+
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+
+#include <atomic>
+
+// TSC clock cycle duration, in nanoseconds, shared by the TSC timers.
+// The first call determines it, later calls return the same value:
+// 1. If the environment variable TSC_TIMER_CACHE names a file written by
+//    this function since the last reboot, the value is read from the file.
+// 2. If the CPU reports the TSC frequency (CPUID leaf 0x15), it is used.
+// 3. Otherwise the TSC is calibrated against CLOCK_MONOTONIC_RAW for about
+//    10 milliseconds.
+// In cases 2 and 3 the value is written to the TSC_TIMER_CACHE file, if set.
+// If recalibrate is true, the TSC is calibrated again (case 3) and the new
+// value is returned by the later calls. The calls may come from any thread.
+double TSCClockCycle(bool recalibrate = false);
+
+// Accurate TSC (Time Stamp Counter) timer.
+// This class gives access to the hardware TSC timer. The implementation
+// attempts to make the time measurements as accurate as possible.
+// There are several problems with the TSC timer:
+// 1. RDTSC (the assembler instruction accessing the timer) is not a
+//    serializing instruction, so the hardware can rearrange the execution
+//    order and move some instructions either outside or inside the measured
+//    section.
+//    This can be prevented by calling CPUID instruction (serializing) to
+//    bracket the timed section of the code. Also, the RDTSCP instruction is
+//    half-serializing, it prevents earlier instructions from being executed
+//    later than RDTSCP but does not prevent later instructions from being
+//    executed earlier. Using this instruction allows us to not use CPUID
+//    inside the timed section.
+//    The best order of instructions for using the TSC timer is the following:
+//      ... earlier instructions ...
+//      CPUID - all earlier instructions must finish
+//      RDTSC - store TSC value
+//      ... timed instructions ...
+//      RDTSCP - all timed instructions must finish
+//      CPUID - later instructions cannot start until now
+//      ... later instructions ...
+//    Note that the cost of moving the registers to memory after RDTSC is
+//    counted as a part of timed instructions, but the cost of moving the
+//    registers to memory after RDTSCP is not counted because the move must
+//    necessarily occur after the counter is read.
+// 2. The program may be migrated from one CPU to another while the test is
+//    running. The TSC timer classes do nothing to prevent this, but the helper
+//    class CPU_Limiter can be used to restrict the current thread to the
+//    current CPU.
+// 3. The clock frequency may be changed by the scaling governor. We do not do
+//    anything about this, in general the benchmark should be "primed" by
+//    running CPU at full load (usually run few "dummy" passes of the test) for
+//    some time before doing the real timed test.
+// 4. Start() and Stop() take time themselves, and part of it is counted in
+//    the timed section. This overhead is measured when the clock cycle is
+//    initialized, Stop(true) and StopNS(true) subtract it, which matters for
+//    very short timed sections.
+//
+// Example:
+//   {
+//     CPU_Limiter L; // See below
+//     AccurateTSCTimer T; T.Start();
+//     ... timed code ...
+//     unsigned long t = T.Stop();
+//     cout << "Code takes " << t << cycles << " or " << t*T.ClockCycle() << "ns" << endl;
+//   }
+class AccurateTSCTimer
+{
+    public:
+    // Constructor initializes the clock cycle if it was not already done, see
+    // TSCClockCycle() below.
+    AccurateTSCTimer();
+
+    // Start the timed section. Unlike the symmetric interface of the
+    // HighResTimer class (see timers.h), Start() and Stop() are explicit and
+    // different here. This is because they use different serializing
+    // instructions to prevent instruction reordering in and out of the timed
+    // section.
+    void Start() {
+        __asm__ __volatile__ (
+                "cpuid\n\t"                             // CPUID is a serializing instruction, all preceding instructions must complete
+                "rdtsc\n\t"                             // RDTSC is not a serializing instruction
+                "mov %%eax, %0\n\t"                     // Save results before CPUID clobbers registers
+                "mov %%edx, %1\n\t"
+                : "=r"(low1), "=r"(high1)
+                : : "%rax", "%rbx", "%rcx", "%rdx");    // Clobbred registers
+    }
+
+    // End the timed section and return the time since the last Start() call,
+    // in clock cycles. If subtract_overhead is true, the cost of an empty
+    // timed section (see Overhead()) is subtracted, down to 0.
+    unsigned long Stop(bool subtract_overhead = false) {
+        __asm__ __volatile__ (
+                "rdtscp\n\t"                            // RDTSCP is "half-serializing", all earlier instructions must finish prior to it
+                "mov %%eax, %0\n\t"                     // Save results before CPUID clobbers registers
+                "mov %%edx, %1\n\t"
+                "cpuid\n\t"                             // CPUID is a serializing instruction, no subsequent instructions may run before it
+                : "=r"(low2), "=r"(high2)
+                : : "%rax", "%rbx", "%rcx", "%rdx");    // Clobbred registers
+        uint64_t start = (static_cast<uint64_t>(high1) << 32) | low1;
+        uint64_t stop  = (static_cast<uint64_t>(high2) << 32) | low2;
+        uint64_t t = stop - start;
+        if (subtract_overhead) {
+            const unsigned long overhead = overhead_.load(std::memory_order_relaxed);
+            t = t > overhead ? t - overhead : 0;
+        }
+        return t;
+    }
+
+    // Similar to Stop() but convert the time to nanoseconds.
+    double StopNS(bool subtract_overhead = false) {
+        return Stop(subtract_overhead)*TSCClockCycle();
+    }
+
+    // Clock cycle duration, in nanoseconds, see TSCClockCycle().
+    double ClockCycle() { return TSCClockCycle(); }
+
+    // Cost of an empty timed section, in clock cycles: the minimum time
+    // between Start() and Stop() over many tries, measured when the clock
+    // cycle is initialized.
+    static unsigned long Overhead() { return overhead_.load(std::memory_order_relaxed); }
+
+    // Effective resolution of the timer, in nanoseconds: the smallest
+    // difference between two distinct measurements of the empty section.
+    static double Resolution() { return resolution_.load(std::memory_order_relaxed)*TSCClockCycle(); }
+
+    // Measure the clock cycle (in nanoseconds) and return the new value.
+    // The constructor initializes the clock cycle the first time, this
+    // function can be called to measure it again at any time if the user
+    // suspects that the clock frequency might have changed. The new value is
+    // used by both TSC timers, the overhead and resolution of this timer are
+    // measured again as well.
+    static double InitClockCycle();
+
+    private:
+    static std::atomic<unsigned long> overhead_;        // Clock cycles
+    static std::atomic<unsigned long> resolution_;      // Clock cycles
+    uint32_t low1, high1, low2, high2;
+};
+
+// "Fast" TSC timer.
+// This class does not use CPUID instructions to prevent hardware instruction
+// reordering. It executes the minimum necessary number of instructions to
+// access the TSC counter. 
+// Note that in practice the minimum granularity of the FastTSCTimer is not
+// always lower than the granularity of the AccurateTSCTimer, i.e. FastTSCTimer
+// is not necessarily faster.
+class FastTSCTimer
+{
+    public:
+    // Constructor initializes the clock cycle if it was not already done, see
+    // TSCClockCycle() below.
+    FastTSCTimer();
+
+    // Start the timed section.
+    void Start() {
+        __asm__ __volatile__ ("rdtsc" : "=a"(low1), "=d"(high1) : : "%ebx", "%ecx");
+    }
+
+    // End the timed section and return the time since the last Start() call,
+    // in clock cycles. If subtract_overhead is true, the cost of an empty
+    // timed section (see Overhead()) is subtracted, down to 0.
+    unsigned long Stop(bool subtract_overhead = false) {
+        __asm__ __volatile__ ("rdtscp" : "=a"(low2), "=d"(high2) : : "%ebx", "%ecx");
+        uint64_t start = (static_cast<uint64_t>(high1) << 32) | low1;
+        uint64_t stop  = (static_cast<uint64_t>(high2) << 32) | low2;
+        uint64_t t = stop - start;
+        if (subtract_overhead) {
+            const unsigned long overhead = overhead_.load(std::memory_order_relaxed);
+            t = t > overhead ? t - overhead : 0;
+        }
+        return t;
+    }
+
+    // Similar to Stop() but convert the time to nanoseconds.
+    double StopNS(bool subtract_overhead = false) {
+        return Stop(subtract_overhead)*TSCClockCycle();
+    }
+
+    // Current TSC value, for time stamps rather than intervals.
+    static uint64_t Now() {
+        uint32_t low, high;
+        __asm__ __volatile__ ("rdtsc" : "=a"(low), "=d"(high));
+        return (static_cast<uint64_t>(high) << 32) | low;
+    }
+
+    // Clock cycle duration, in nanoseconds, see TSCClockCycle().
+    double ClockCycle() { return TSCClockCycle(); }
+
+    // Cost of an empty timed section and effective resolution, see
+    // AccurateTSCTimer.
+    static unsigned long Overhead() { return overhead_.load(std::memory_order_relaxed); }
+    static double Resolution() { return resolution_.load(std::memory_order_relaxed)*TSCClockCycle(); }
+
+    // Measure the clock cycle (in nanoseconds) and return the new value, see
+    // AccurateTSCTimer::InitClockCycle().
+    static double InitClockCycle();
+
+    private:
+    static std::atomic<unsigned long> overhead_;        // Clock cycles
+    static std::atomic<unsigned long> resolution_;      // Clock cycles
+    uint32_t low1, high1, low2, high2;
+};
+
+// The CPU_Limiter class restricts the current thread to the current CPU (i.e.
+// the CPU it was running on when the class was constructed) for the lifetime
+// of the CPU_Limiter object. It also blocks all signals except SIGPROF,
+// SIGSEGV, SIGBUS, and SIGTERM.
+// 
+// Example:
+//   {
+//     CPU_Limiter L;
+//     AccurateTSCTimer T; T.Start();
+//     ... timed code - thread is locked to one CPU ...
+//     double t = T.StopNS();
+//   }
+class CPU_Limiter
+{
+    public:
+    CPU_Limiter();
+    ~CPU_Limiter();
+
+    private:
+    cpu_set_t saved_cpu_;
+    sigset_t saved_sigmask_;
+};
+
+#endif // TSC_TIMER_H_
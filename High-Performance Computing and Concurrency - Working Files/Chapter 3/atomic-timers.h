@@ -0,0 +1,137 @@
+#ifndef ATOMIC_TIMERS_H_
+#define ATOMIC_TIMERS_H_
+
+// IMPORTANT: all programs using these high-resolution timers must be linked with -lrt.
+
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+
+// Thread-safe clock (accumulating timer) based on high-resolution timers.
+// This is the thread-safe version of HighResClock (see timers.h): any number
+// of threads can time intervals with the same clock at the same time, and the
+// cumulative time is the sum of the intervals timed by all threads.
+// Each thread accumulates its time in its own record, allocated the first
+// time the thread uses the clock, so timing does not cause contention between
+// the threads: start_timer() and stop_timer() find the record of the calling
+// thread in a small thread-local cache and touch only that record.
+// get_cum_time() adds up the records of all threads, including the threads
+// that have exited.
+// The timer state (running, stopped) is per thread: start_timer(),
+// stop_timer(), read_timer(), clock_was_started() and clock_is_running()
+// apply to the calling thread only.
+//
+// Example:
+//   AtomicHighResClock C(CLOCK_MONOTONIC);
+//   ... in each thread ...
+//   C.start_timer();
+//   ... timed phase ...
+//   C.stop_timer();
+//   ... after the threads are done ...
+//   cout << "Total time in the phase: " << C.get_cum_time() << endl;
+class AtomicHighResClock {
+    public:
+    // Construct clock of the given type, start accumulation from zero time.
+    explicit AtomicHighResClock(clockid_t clock);
+    ~AtomicHighResClock();
+
+    // Start timing in the calling thread.
+    void start_timer() {
+        Record* r = record();
+        r->state = RUNNING;
+        clock_gettime(clock_, &r->start);
+    }
+
+    // Return time in seconds between the stop time and the last start time
+    // in the calling thread, and add it to the cumulative time.
+    // If stop_timer() is called without a preceding start_timer(), -1 is returned.
+    // -1 is returned on error.
+    double stop_timer() {
+        Record* r = record();
+        if (r->state != RUNNING) { r->state = INVALID_STOP; return -1.0; } else r->state = STOPPED;
+        struct timespec now;
+        if (clock_gettime(clock_, &now) != 0) return -1;
+        // Set stop = 0 to prevent negative time stamps which can happen if stop is "earlier" than start.
+        if ((now.tv_sec < r->start.tv_sec) || ((now.tv_sec == r->start.tv_sec) && (now.tv_nsec < r->start.tv_nsec))) r->stop = 0;
+        else r->stop = static_cast<uint64_t>(1e9*(now.tv_sec - r->start.tv_sec) + (now.tv_nsec - r->start.tv_nsec));
+        // Only this thread adds to its record, reset() may clear it.
+        r->accumulated.fetch_add(r->stop, std::memory_order_relaxed);
+        return r->stop*1e-9;
+    }
+
+    // Return time in seconds between current time and the last start time in
+    // the calling thread.
+    // If read_timer() is called after a valid stop_timer(), the last stop_timer() value is returned.
+    // If read_timer() is called without a preceding start_timer(), -1 is returned.
+    // -1 is returned on error.
+    double read_timer() {
+        const Record* r = record();
+        if (r->state == NEVER_STARTED || r->state == INVALID_STOP) return -1;
+        if (r->state == STOPPED) return r->stop*1e-9;
+        struct timespec now;
+        if (clock_gettime(clock_, &now) != 0) return -1;
+        return now.tv_sec - r->start.tv_sec + 1e-9*(now.tv_nsec - r->start.tv_nsec);
+    }
+
+    // Return cumulative time in seconds, summed over all threads.
+    // This is the sum of the (stop_timer() - start_timer()) calls.
+    double get_cum_time() const;
+
+    // Reset the cumulative time to zero. The intervals that are being timed
+    // are not affected and will be added when stopped.
+    void reset();
+
+    // Check clock status in the calling thread.
+    bool clock_was_started() { State s = record()->state; return s != NEVER_STARTED && s != INVALID_STOP; }
+    bool clock_is_running()  { return record()->state == RUNNING; }
+
+    private:
+    enum State {
+        NEVER_STARTED,
+        RUNNING,         // start_timer() called
+        STOPPED,         // valid stop_timer() call
+        INVALID_STOP     // stop_timer() without start_timer()
+    };
+
+    // Per-thread record. The padding keeps the records of different threads
+    // on different cache lines.
+    struct Record {
+        uint64_t                thread;         // Owner, see ThreadID()
+        Record*                 next;           // All records of the clock
+        State                   state;
+        struct timespec         start;
+        uint64_t                stop;           // Nanoseconds
+        std::atomic<uint64_t>   accumulated;    // Nanoseconds
+        char                    padding[64];
+    };
+
+    // Thread-local cache of the records of the clocks used by the thread,
+    // indexed by the clock ID. The clock IDs are never reused, so the cache
+    // never returns a record of a destroyed clock.
+    static const int kCacheSize = 8;
+    struct CacheEntry {
+        uint64_t clock;
+        Record* record;
+    };
+    static CacheEntry* cache() {
+        static thread_local CacheEntry c[kCacheSize];
+        return c;
+    }
+
+    Record* record() {
+        CacheEntry& e = cache()[id_ & (kCacheSize - 1)];
+        if (e.clock == id_) return e.record;
+        return find_record(&e);
+    }
+    Record* find_record(CacheEntry* e);
+
+    AtomicHighResClock(const AtomicHighResClock&);
+    AtomicHighResClock& operator=(const AtomicHighResClock&);
+
+    const clockid_t         clock_;
+    const uint64_t          id_;                // Unique clock ID, never 0
+    std::atomic<Record*>    records_;
+};
+
+#endif // ATOMIC_TIMERS_H_
@@ -0,0 +1,90 @@
+#ifndef CPU_TOPOLOGY_H_
+#define CPU_TOPOLOGY_H_
+
+#include <string>
+#include <vector>
+
+// CPU topology of the machine, as reported by Linux in
+// /sys/devices/system/cpu: for every online CPU, its core (the SMT siblings
+// share it), its last level cache domain and its NUMA node.
+// The topology is used to pin threads to CPUs according to a policy, so that
+// multithreaded benchmarks measure what they intend to: for example, threads
+// sharing data should run on CPUs sharing a cache (COMPACT), or threads
+// competing for memory bandwidth should be spread over the caches and nodes
+// (SCATTER).
+//
+// Example:
+//   const CPUTopology& T = CPUTopology::Get();
+//   ... in thread i ...
+//   T.PinThread(CPUTopology::ONE_PER_CORE, i);
+//   ... or, with Threads::Thread ...
+//   MyThread t(Threads::Thread::Options().set_cpu(T.CPUForThread(CPUTopology::SCATTER, i)));
+class CPUTopology
+{
+    public:
+    struct CPU {
+        int id;                 // Linux CPU number
+        int core;               // Lowest CPU number of the SMT siblings
+        int smt;                // Index among the SMT siblings, from 0
+        int llc;                // Lowest CPU number sharing the last level cache
+        int node;               // NUMA node
+    };
+
+    // Pinning policies, each is an order in which the threads are assigned
+    // to the CPUs the process is allowed to run on. Thread i runs on CPU
+    // Order(policy)[i % size].
+    enum PinPolicy {
+        NONE,                   // Do not pin
+        COMPACT,                // Fill SMT siblings, then cores of the same cache, then the next cache and node
+        SCATTER,                // Round-robin over the nodes, then caches, then cores, then SMT siblings
+        ONE_PER_CORE,           // Compact, one CPU per core, SMT siblings are never used
+        AVOID_SMT               // Compact, SMT siblings are used only when every core has a thread
+    };
+
+    // Read the topology from the sysfs directory (the argument is for tests).
+    explicit CPUTopology(const char* sysfs = "/sys/devices/system/cpu");
+
+    // Topology of this machine, read once.
+    static const CPUTopology& Get();
+
+    // All online CPUs, ordered by CPU number.
+    const std::vector<CPU>& CPUs() const { return cpus_; }
+    int NumCores() const { return num_cores_; }
+    int NumCaches() const { return num_llcs_; }
+    int NumNodes() const { return num_nodes_; }
+
+    // CPUs the process was allowed to run on when the topology was read, in
+    // the policy order (empty for NONE). Pinning threads later does not
+    // change the order.
+    std::vector<int> Order(PinPolicy policy) const;
+
+    // Same for the given set of CPUs.
+    std::vector<int> Order(PinPolicy policy, const std::vector<int>& allowed) const;
+
+    // CPU for thread i according to the policy, -1 for NONE.
+    int CPUForThread(PinPolicy policy, int i) const;
+
+    // Pin the calling thread to the CPU for thread i, return false if it
+    // could not be done. Does nothing for NONE.
+    bool PinThread(PinPolicy policy, int i) const;
+
+    // Pin the calling thread to one CPU (does nothing for -1).
+    static bool PinThreadToCPU(int cpu);
+
+    // Policy by name ("none", "compact", "scatter", "one-per-core",
+    // "avoid-smt"), NONE if the name is not known or is NULL. Benchmarks
+    // usually get it from an environment variable.
+    static PinPolicy ParsePinPolicy(const char* name);
+
+    // Parse a Linux CPU list, such as "0-3,8,10-11".
+    static std::vector<int> ParseCPUList(const std::string& list);
+
+    private:
+    std::vector<CPU> cpus_;
+    std::vector<int> allowed_;
+    int num_cores_;
+    int num_llcs_;
+    int num_nodes_;
+};
+
+#endif // CPU_TOPOLOGY_H_
@@ -0,0 +1,123 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <linux/perf_event.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Hardware performance counters (cache misses, instructions retired etc.)
+// accessed through the Linux perf_event_open() interface.
+// The counters are opened as one group so they are scheduled on the PMU
+// together and their values are consistent with each other. They count the
+// events of the calling thread in user space only, so the group must be
+// created and used by the thread that is measured.
+// When the kernel allows it (see /sys/bus/event_source/devices/cpu/rdpmc)
+// and none of the counters were multiplexed, the counters are read in user
+// space with the RDPMC instruction, otherwise with the read() system call,
+// and the values are scaled by the fraction of time the counters ran.
+// Counters that cannot be opened (not supported by the CPU or the VM, not
+// permitted by /proc/sys/kernel/perf_event_paranoid) are left out, so the
+// group may have fewer counters than were added, or none at all; the code
+// using it works the same way.
+//
+// Example:
+//   PerfCounterGroup P;
+//   P.AddDefaultCounters();
+//   P.Start();
+//   ... measured code ...
+//   P.Stop();
+//   for (size_t i = 0; i < P.Size(); ++i) cout << P.Name(i) << ": " << P.Value(i) << endl;
+class PerfCounterGroup
+{
+    public:
+    PerfCounterGroup() : rdpmc_(false), started_(false) {}
+    ~PerfCounterGroup();
+
+    // Add a counter of the given perf event type and config (see
+    // perf_event_open(2)), return false if it cannot be opened.
+    bool Add(const char* name, uint32_t type, uint64_t config);
+
+    // Add the instructions, cycles, cache-misses, llc-misses and
+    // branch-misses counters, return the number of counters opened.
+    size_t AddDefaultCounters();
+
+    size_t Size() const { return counters_.size(); }
+    const std::string& Name(size_t i) const { return counters_[i].name; }
+
+    // Sum of the counts between all Start() and Stop() calls.
+    uint64_t Value(size_t i) const { return values_[i]; }
+
+    // True if the last Start() used RDPMC.
+    bool UsesRDPMC() const { return rdpmc_; }
+
+    // Stop() reads the counters the same way as Start() did (the RDPMC
+    // values are raw, the read() values are scaled), and adds nothing if
+    // either read failed or Start() was not called.
+    void Start();
+    void Stop();
+    void Reset() { values_.assign(values_.size(), 0); }
+
+    private:
+    struct Counter {
+        std::string name;
+        int fd;
+        struct perf_event_mmap_page* page;      // For RDPMC, or NULL
+    };
+
+    // False if the counters cannot be read, values is then undefined.
+    bool Read(uint64_t* values);
+    bool ReadRDPMC(uint64_t* values);
+
+    PerfCounterGroup(const PerfCounterGroup&);
+    PerfCounterGroup& operator=(const PerfCounterGroup&);
+
+    std::vector<Counter> counters_;
+    std::vector<uint64_t> start_;
+    std::vector<uint64_t> stop_;
+    std::vector<uint64_t> values_;
+    std::vector<uint64_t> buffer_;                      // For read()
+    bool rdpmc_;
+    bool started_;                                      // start_ is valid
+};
+
+// Report the counters of a Google Benchmark thread, as events per iteration.
+// With the versions of the benchmark library that have user counters, the
+// values are added to state.counters (and summed over the threads by the
+// library), otherwise the first thread puts them in the benchmark label.
+//
+// Example:
+//   void BM_x(benchmark::State& state) {
+//     PerfCounterGroup P;
+//     P.AddDefaultCounters();
+//     P.Start();
+//     while (state.KeepRunning()) { ... }
+//     P.Stop();
+//     ReportPerfCounters(state, P);
+//   }
+template <typename State> auto ReportPerfCounters(State& state, const PerfCounterGroup& P, int) -> decltype(state.counters, void())
+{
+    for (size_t i = 0; i < P.Size(); ++i) {
+        state.counters[P.Name(i)] = double(P.Value(i))/state.iterations();
+    }
+}
+
+template <typename State> void ReportPerfCounters(State& state, const PerfCounterGroup& P, long)
+{
+    if (state.thread_index != 0 || P.Size() == 0) return;
+    std::ostringstream label;
+    for (size_t i = 0; i < P.Size(); ++i) {
+        label << (i ? " " : "") << P.Name(i) << "=" << double(P.Value(i))/state.iterations();
+    }
+    state.SetLabel(label.str());
+}
+
+template <typename State> void ReportPerfCounters(State& state, const PerfCounterGroup& P)
+{
+    ReportPerfCounters(state, P, 0);
+}
+
+#endif // PERF_COUNTERS_H_
@@ -0,0 +1,68 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+// In-process sampling profiler.
+// A CPU-time timer sends SIGPROF to the running thread every 1/frequency
+// seconds of CPU time; the signal handler records the call stack of the
+// thread in a buffer owned by the thread, without locks or allocation (the
+// buffer of a thread is mapped the first time it gets a sample). When the
+// profiler stops, the samples of all threads are aggregated and written in
+// the folded stack format ("main;f;g 42" - the stack from the root, and the
+// number of samples), which is the input of flamegraph.pl and speedscope.
+// Note that CPU_Limiter and Threads::Thread leave SIGPROF unblocked for this.
+//
+// The timer can be either one process-wide timer (setitimer(ITIMER_PROF)),
+// which samples all threads including the ones the program did not create
+// itself, such as the Google Benchmark threads, or per-thread timers
+// (timer_create(CLOCK_THREAD_CPUTIME_ID)), which sample only the threads that
+// call ProfilerRegisterThread(), with accurate per-thread CPU time.
+//
+// By default the stacks are captured by walking the frame pointers, which is
+// async-signal-safe: the frames are read with process_vm_readv(), which
+// fails instead of faulting on bad addresses. The code must be compiled with
+// -fno-omit-frame-pointer, otherwise the stacks stop at the first function
+// without a frame pointer (glibc and libstdc++ usually have none).
+// The alternative is backtrace(), which uses the unwind tables and works
+// without frame pointers, but is not async-signal-safe: before glibc 2.35 it
+// takes the loader lock, so it is refused there, and it still takes the
+// unwinder lock for frames registered with __register_frame_info() (JIT
+// code). A sample that interrupts dlopen() or the unwinding of an exception
+// can deadlock.
+// Function names are found with dladdr(), so programs should be linked with
+// -rdynamic, otherwise the frames are written as binary+offset (see
+// addr2line).
+//
+// Any program can be profiled without changes by preloading the profiler
+// library built by the makefile (LD_PRELOAD does not accept paths with
+// spaces, copy the library elsewhere first):
+//   PROFILER_OUTPUT=prof.folded LD_PRELOAD=/tmp/libprofiler.so ./sharing_false_mbm
+//   flamegraph.pl prof.folded > prof.svg
+// PROFILER_FREQUENCY sets the sampling frequency (samples per CPU second,
+// default 100), PROFILER_UNWIND=backtrace selects backtrace(). The same
+// variables work in programs linked with profiler.C.
+// Every process started with the variables writes a profile, "%p" in
+// PROFILER_OUTPUT is replaced by the process id.
+//
+// Example:
+//   ProfilerStart("prof.folded");
+//   ... profiled code ...
+//   ProfilerStop();
+
+// Start profiling, return false if the profiler is already running, the
+// timer cannot be created or the stacks cannot be captured (process_vm_readv()
+// is not allowed, or glibc is too old for backtrace()). If per_thread is
+// true, only the calling thread and the threads that call
+// ProfilerRegisterThread() are sampled. If use_backtrace is true, the stacks
+// are captured with backtrace() instead of the frame pointers.
+bool ProfilerStart(const char* path, int frequency = 100, bool per_thread = false, bool use_backtrace = false);
+
+// Sample the calling thread with its own timer (per-thread mode only, does
+// nothing otherwise). Returns false if the timer cannot be created.
+bool ProfilerRegisterThread();
+
+// Stop profiling and write the profile. Returns the number of samples
+// written, or -1 if the profiler was not running or the file could not be
+// written.
+long ProfilerStop();
+
+#endif // PROFILER_H_
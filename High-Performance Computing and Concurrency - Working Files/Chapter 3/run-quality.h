@@ -0,0 +1,102 @@
+#ifndef RUN_QUALITY_H_
+#define RUN_QUALITY_H_
+
+#include <stdint.h>
+
+#include <string>
+
+// Quality of a timed run: was the measurement disturbed by frequency changes,
+// migration to another CPU, context switches or interrupts?
+// The TSC ticks at a constant rate, so TSC timers do not see the core clock
+// frequency change (turbo, power saving, thermal throttling); the time of the
+// same code changes instead. RunQualityMonitor samples the effective core
+// frequency before and after the timed region, and over the region if the
+// APERF/MPERF MSRs can be read (/dev/cpu/N/msr, which usually needs root and
+// the msr module). Otherwise the frequency is measured with a short busy
+// loop of dependent additions, which take one core cycle each.
+// The monitor also checks whether the thread moved to another CPU and counts
+// its context switches and the interrupts on its CPU.
+//
+// Example:
+//   RunQualityMonitor M;
+//   M.Start();
+//   ... timed code ...
+//   RunQuality Q = M.Stop();
+//   if (Q.Noisy()) cout << "Noisy run: " << Q.Describe() << endl;
+// Or, to rerun noisy measurements:
+//   double t = MeasureQuietly([&]() { ... timed code ... }, 5, &Q);
+
+// Thresholds for flagging a run as noisy.
+struct RunQualityOptions {
+    RunQualityOptions() : max_frequency_change(0.05), min_frequency_ratio(0.95), max_interrupts_per_ms(1.5), max_context_switches(0) {}
+    double max_frequency_change;        // Relative change between the start and the end
+    double min_frequency_ratio;         // Average core frequency over the region to the base frequency (MSR only)
+    double max_interrupts_per_ms;       // More than the timer tick rate means other interrupts
+    long max_context_switches;          // Involuntary
+};
+
+struct RunQuality {
+    double time;                        // Seconds
+    double frequency_start;             // Effective core frequency, GHz
+    double frequency_end;
+    double frequency_ratio;             // APERF/MPERF over the region, 0 if unknown
+    bool migrated;                      // Ran on different CPUs at the start and the end
+    long context_switches;              // Involuntary
+    long interrupts;                    // On the CPU at the start, -1 if unknown
+
+    bool FrequencyChanged(const RunQualityOptions& o = RunQualityOptions()) const;
+    bool Throttled(const RunQualityOptions& o = RunQualityOptions()) const;
+    bool TooManyInterrupts(const RunQualityOptions& o = RunQualityOptions()) const;
+    bool Noisy(const RunQualityOptions& o = RunQualityOptions()) const;
+
+    // One line: the measurements and what is wrong with them.
+    std::string Describe(const RunQualityOptions& o = RunQualityOptions()) const;
+};
+
+class RunQualityMonitor
+{
+    public:
+    RunQualityMonitor();
+
+    void Start();
+    RunQuality Stop();
+
+    // True if the frequency is measured with the APERF/MPERF MSRs.
+    static bool HasMSR();
+
+    // Effective core frequency of the CPU the thread runs on, in GHz,
+    // measured over about 100 microseconds.
+    static double SampleFrequency();
+
+    private:
+    RunQuality q_;
+    int cpu_;
+    uint64_t tsc_;
+    uint64_t aperf_, mperf_;
+    long nivcsw_;
+    long interrupts_;
+};
+
+// Run f() until a run is not noisy, at most max_runs times, and return the
+// time of the first quiet run in seconds, or of the fastest run if all runs
+// were noisy. The quality of the returned run is stored in *q, if not NULL.
+// If max_runs < 1, f() is not run and the time and *q are all 0.
+template <typename F> double MeasureQuietly(F f, int max_runs, RunQuality* q = NULL, const RunQualityOptions& o = RunQualityOptions())
+{
+    RunQualityMonitor M;
+    RunQuality best = RunQuality();
+    for (int i = 0; i < max_runs; ++i) {
+        M.Start();
+        f();
+        const RunQuality r = M.Stop();
+        if (i == 0 || r.time < best.time) best = r;
+        if (!r.Noisy(o)) {
+            best = r;
+            break;
+        }
+    }
+    if (q) *q = best;
+    return best.time;
+}
+
+#endif // RUN_QUALITY_H_
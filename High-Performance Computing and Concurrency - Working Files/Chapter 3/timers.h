@@ -72,7 +72,7 @@ class HighResThreadTimer : public HighResTimer {
 
 // Clock (accumulating timer) based on high-resolution timers.
 // Time accumulation of this clock is not thread-safe, for thread-safe timers
-// see base/atomics/atomic-timers.h.
+// see atomic-timers.h.
 class HighResClock {
     public:
     // Construct lock of the given type, start accumulation from zero time.
@@ -0,0 +1,116 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <tsc-timer.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <ostream>
+
+// Scoped tracing profiler.
+// TRACE_SCOPE("name") records the time when the enclosing scope is entered
+// and left, using the TSC (see FastTSCTimer). Each thread writes its records
+// into its own ring buffer: the hot path is two TSC reads and a few stores,
+// with no locks, no allocation and no shared cache lines. The buffer of a
+// thread is allocated the first time the thread traces something. When the
+// buffer is full the oldest records are overwritten.
+// TraceDump() writes the records of all threads, converted to real time, in
+// the Chrome trace event format, which can be loaded in chrome://tracing or
+// https://ui.perfetto.dev. The names must be string literals (or otherwise
+// outlive the dump), only the pointers are recorded.
+//
+// Example:
+//   void Stage1() {
+//     TRACE_SCOPE("Stage1");
+//     ... code ...
+//   }
+//   ... after the threads are done ...
+//   std::ofstream out("trace.json");
+//   TraceDump(out);
+//
+// If NO_TRACE is defined, TRACE_SCOPE compiles to nothing.
+
+// Per-thread trace buffer.
+class TraceBuffer
+{
+    public:
+    static const size_t kSize = 1 << 16;                // Records, power of 2
+
+    // Buffer of the current thread.
+    static TraceBuffer* Get() {
+        static thread_local TraceBuffer* buffer = NULL;
+        if (!buffer) buffer = Register();
+        return buffer;
+    }
+
+    // The lowest bit of the record time stamp is set for the end records.
+    void Begin(const char* name) { Add(name, FastTSCTimer::Now() << 1); }
+    void End(const char* name) { Add(name, (FastTSCTimer::Now() << 1) | 1); }
+
+    private:
+    friend void TraceDump(std::ostream& out);
+    friend void TraceClear();
+
+    struct Record {
+        std::atomic<const char*> name;
+        std::atomic<uint64_t> stamp;
+    };
+
+    explicit TraceBuffer(long tid) : tid_(tid), head_(0), tail_(0), next_(NULL) {}
+    static TraceBuffer* Register();
+
+    // Only the owning thread writes, the dumper may read concurrently. The
+    // fence orders the store of the head of the previous record before the
+    // stores of this one, so the dumper can tell which records it read were
+    // being overwritten: it reads the records, then the head again.
+    void Add(const char* name, uint64_t stamp) {
+        const uint64_t i = head_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Record& r = records_[i & (kSize - 1)];
+        r.name.store(name, std::memory_order_relaxed);
+        r.stamp.store(stamp, std::memory_order_relaxed);
+        head_.store(i + 1, std::memory_order_release);
+    }
+
+    const long tid_;                                    // Kernel thread ID
+    std::atomic<uint64_t> head_;                        // Records written
+    std::atomic<uint64_t> tail_;                        // Records cleared
+    TraceBuffer* next_;                                 // All buffers, see Register()
+    Record records_[kSize];
+};
+
+// Records the entry to and exit from a scope.
+class TraceScope
+{
+    public:
+    explicit TraceScope(const char* name) : buffer_(TraceBuffer::Get()), name_(name) { buffer_->Begin(name_); }
+    ~TraceScope() { buffer_->End(name_); }
+
+    private:
+    TraceScope(const TraceScope&);
+    TraceScope& operator=(const TraceScope&);
+    TraceBuffer* const buffer_;
+    const char* const name_;
+};
+
+// Write the records of all threads as a Chrome trace (JSON). The TSC clock is
+// measured again (see FastTSCTimer::InitClockCycle()) to convert the time
+// stamps to microseconds since the earliest record. Records that are
+// overwritten while the dump reads them are skipped, as are the end records
+// whose begin records were overwritten.
+void TraceDump(std::ostream& out);
+
+// Discard the records written so far.
+void TraceClear();
+
+#ifdef NO_TRACE
+#define TRACE_SCOPE(name)
+#else
+#define TRACE_CONCAT1(x, y) x##y
+#define TRACE_CONCAT(x, y) TRACE_CONCAT1(x, y)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#endif
+
+#endif // TRACE_H_
@@ -7,6 +7,20 @@
 #include <signal.h>
 #include <stdint.h>
 
+#include <atomic>
+
+// TSC clock cycle duration, in nanoseconds, shared by the TSC timers.
+// The first call determines it, later calls return the same value:
+// 1. If the environment variable TSC_TIMER_CACHE names a file written by
+//    this function since the last reboot, the value is read from the file.
+// 2. If the CPU reports the TSC frequency (CPUID leaf 0x15), it is used.
+// 3. Otherwise the TSC is calibrated against CLOCK_MONOTONIC_RAW for about
+//    10 milliseconds.
+// In cases 2 and 3 the value is written to the TSC_TIMER_CACHE file, if set.
+// If recalibrate is true, the TSC is calibrated again (case 3) and the new
+// value is returned by the later calls. The calls may come from any thread.
+double TSCClockCycle(bool recalibrate = false);
+
 // Accurate TSC (Time Stamp Counter) timer.
 // This class gives access to the hardware TSC timer. The implementation
 // attempts to make the time measurements as accurate as possible.
@@ -41,6 +55,10 @@
 //    anything about this, in general the benchmark should be "primed" by
 //    running CPU at full load (usually run few "dummy" passes of the test) for
 //    some time before doing the real timed test.
+// 4. Start() and Stop() take time themselves, and part of it is counted in
+//    the timed section. This overhead is measured when the clock cycle is
+//    initialized, Stop(true) and StopNS(true) subtract it, which matters for
+//    very short timed sections.
 //
 // Example:
 //   {
@@ -53,9 +71,8 @@
 class AccurateTSCTimer
 {
     public:
-    // Constructor initializes the clock cycle measurement if it was not
-    // already done. Note that this initialization will take approximately one
-    // real-time second (the first time it happens).
+    // Constructor initializes the clock cycle if it was not already done, see
+    // TSCClockCycle() below.
     AccurateTSCTimer();
 
     // Start the timed section. Unlike the symmetric interface of the
@@ -74,8 +91,9 @@ class AccurateTSCTimer
     }
 
     // End the timed section and return the time since the last Start() call,
-    // in clock cycles.
-    unsigned long Stop() {
+    // in clock cycles. If subtract_overhead is true, the cost of an empty
+    // timed section (see Overhead()) is subtracted, down to 0.
+    unsigned long Stop(bool subtract_overhead = false) {
         __asm__ __volatile__ (
                 "rdtscp\n\t"                            // RDTSCP is "half-serializing", all earlier instructions must finish prior to it
                 "mov %%eax, %0\n\t"                     // Save results before CPUID clobbers registers
@@ -85,25 +103,42 @@ class AccurateTSCTimer
                 : : "%rax", "%rbx", "%rcx", "%rdx");    // Clobbred registers
         uint64_t start = (static_cast<uint64_t>(high1) << 32) | low1;
         uint64_t stop  = (static_cast<uint64_t>(high2) << 32) | low2;
-        return stop - start;
+        uint64_t t = stop - start;
+        if (subtract_overhead) {
+            const unsigned long overhead = overhead_.load(std::memory_order_relaxed);
+            t = t > overhead ? t - overhead : 0;
+        }
+        return t;
     }
 
     // Similar to Stop() but convert the time to nanoseconds.
-    double StopNS() {
-        return Stop()*clock_cycle_;
+    double StopNS(bool subtract_overhead = false) {
+        return Stop(subtract_overhead)*TSCClockCycle();
     }
 
-    // Clock cycle duration, in nanoseconds. 
-    double ClockCycle() { return clock_cycle_; }
+    // Clock cycle duration, in nanoseconds, see TSCClockCycle().
+    double ClockCycle() { return TSCClockCycle(); }
+
+    // Cost of an empty timed section, in clock cycles: the minimum time
+    // between Start() and Stop() over many tries, measured when the clock
+    // cycle is initialized.
+    static unsigned long Overhead() { return overhead_.load(std::memory_order_relaxed); }
+
+    // Effective resolution of the timer, in nanoseconds: the smallest
+    // difference between two distinct measurements of the empty section.
+    static double Resolution() { return resolution_.load(std::memory_order_relaxed)*TSCClockCycle(); }
 
     // Measure the clock cycle (in nanoseconds) and return the new value.
-    // The user must call this function before calling StopNS() or ClockCycle().
-    // Usually this value is computed once, but it can be recomputed at any
-    // time if the user suspects that the clock frequency might have changed.
+    // The constructor initializes the clock cycle the first time, this
+    // function can be called to measure it again at any time if the user
+    // suspects that the clock frequency might have changed. The new value is
+    // used by both TSC timers, the overhead and resolution of this timer are
+    // measured again as well.
     static double InitClockCycle();
 
     private:
-    static double clock_cycle_;                         // Nanoseconds
+    static std::atomic<unsigned long> overhead_;        // Clock cycles
+    static std::atomic<unsigned long> resolution_;      // Clock cycles
     uint32_t low1, high1, low2, high2;
 };
 
@@ -117,9 +152,8 @@ class AccurateTSCTimer
 class FastTSCTimer
 {
     public:
-    // Constructor initializes the clock cycle measurement if it was not
-    // already done. Note that this initialization will take approximately one
-    // real-time second (the first time it happens).
+    // Constructor initializes the clock cycle if it was not already done, see
+    // TSCClockCycle() below.
     FastTSCTimer();
 
     // Start the timed section.
@@ -128,27 +162,47 @@ class FastTSCTimer
     }
 
     // End the timed section and return the time since the last Start() call,
-    // in clock cycles.
-    unsigned long Stop() {
+    // in clock cycles. If subtract_overhead is true, the cost of an empty
+    // timed section (see Overhead()) is subtracted, down to 0.
+    unsigned long Stop(bool subtract_overhead = false) {
         __asm__ __volatile__ ("rdtscp" : "=a"(low2), "=d"(high2) : : "%ebx", "%ecx");
         uint64_t start = (static_cast<uint64_t>(high1) << 32) | low1;
         uint64_t stop  = (static_cast<uint64_t>(high2) << 32) | low2;
-        return stop - start;
+        uint64_t t = stop - start;
+        if (subtract_overhead) {
+            const unsigned long overhead = overhead_.load(std::memory_order_relaxed);
+            t = t > overhead ? t - overhead : 0;
+        }
+        return t;
     }
 
     // Similar to Stop() but convert the time to nanoseconds.
-    double StopNS() {
-        return Stop()*clock_cycle_;
+    double StopNS(bool subtract_overhead = false) {
+        return Stop(subtract_overhead)*TSCClockCycle();
     }
 
-    // Clock cycle duration, in nanoseconds.
-    double ClockCycle() { return clock_cycle_; }
+    // Current TSC value, for time stamps rather than intervals.
+    static uint64_t Now() {
+        uint32_t low, high;
+        __asm__ __volatile__ ("rdtsc" : "=a"(low), "=d"(high));
+        return (static_cast<uint64_t>(high) << 32) | low;
+    }
 
-    // Measure the clock cycle (in nanoseconds) and return the new value.
+    // Clock cycle duration, in nanoseconds, see TSCClockCycle().
+    double ClockCycle() { return TSCClockCycle(); }
+
+    // Cost of an empty timed section and effective resolution, see
+    // AccurateTSCTimer.
+    static unsigned long Overhead() { return overhead_.load(std::memory_order_relaxed); }
+    static double Resolution() { return resolution_.load(std::memory_order_relaxed)*TSCClockCycle(); }
+
+    // Measure the clock cycle (in nanoseconds) and return the new value, see
+    // AccurateTSCTimer::InitClockCycle().
     static double InitClockCycle();
 
     private:
-    static double clock_cycle_;                         // Nanoseconds
+    static std::atomic<unsigned long> overhead_;        // Clock cycles
+    static std::atomic<unsigned long> resolution_;      // Clock cycles
     uint32_t low1, high1, low2, high2;
 };
 
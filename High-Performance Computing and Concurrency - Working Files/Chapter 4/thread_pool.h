@@ -0,0 +1,123 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <common.h>
+#include <thread.h>
+
+// The ThreadPool class runs tasks on a fixed set of threads, which are
+// started once, so that submitting a task costs a queue operation instead of
+// creating and joining a thread (see threads_mbm.C).
+//
+// Tasks are submitted to a bounded lock-free queue (several producers,
+// several consumers). Idle threads spin for a short while, then sleep on a
+// condition variable; the submitting thread takes the lock only when some
+// thread sleeps. If the queue is full, the submitting thread runs the task
+// itself.
+//
+//  Example:
+//    Threads::ThreadPool pool(4);
+//    std::future<int> f = pool.Submit([]() { return 42; });
+//    pool.Execute([&]() { ... });      // No future, a little cheaper
+//    ...
+//    int x = f.get();
+//
+// The destructor runs the tasks still in the queue, then joins the threads.
+// Tasks must not throw from Execute(); exceptions thrown by tasks from
+// Submit() are stored in the future.
+
+namespace Threads {
+class ThreadPool
+{
+    public:
+    // Start num_threads threads with the given options (for example, the
+    // stack size). The queue holds at least queue_size tasks.
+    explicit ThreadPool(size_t num_threads, const Thread::Options& options = Thread::Options(), size_t queue_size = 1024);
+
+    // Run the tasks still in the queue and join the threads.
+    ~ThreadPool();
+
+    size_t num_threads() const { return threads_.size(); }
+
+    // Run f() on one of the threads, return the future of its result.
+    template <typename F> std::future<typename std::result_of<F()>::type> Submit(F f) {
+        typedef typename std::result_of<F()>::type R;
+        std::packaged_task<R()> task(std::move(f));
+        std::future<R> res = task.get_future();
+        Push(new FunctionTask<std::packaged_task<R()> >(std::move(task)));
+        return res;
+    }
+
+    // Run f() on one of the threads.
+    template <typename F> void Execute(F f) {
+        Push(new FunctionTask<F>(std::move(f)));
+    }
+
+    private:
+    class Task {
+        public:
+        virtual ~Task() {}
+        virtual void Run() = 0;
+    };
+
+    template <typename F> class FunctionTask : public Task {
+        public:
+        explicit FunctionTask(F&& f) : f_(std::move(f)) {}
+        virtual void Run() { f_(); }
+        private:
+        F f_;
+    };
+
+    class Worker : public Thread {
+        public:
+        Worker(ThreadPool* pool, const Thread::Options& options) : Thread(options), pool_(pool) {}
+        protected:
+        virtual void Run() { pool_->Work(); }
+        private:
+        ThreadPool* const pool_;
+    };
+
+    // Bounded queue by D. Vyukov: each cell has a sequence number, which
+    // tells the producers and the consumers whose turn it is to use it.
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Task* task;
+    };
+
+    // Queue the task (or run it if the queue is full) and wake up a thread.
+    void Push(Task* task);
+
+    // Lock-free queue operations, false if the queue is full or empty.
+    bool TryPush(Task* task);
+    bool TryPop(Task** task);
+
+    // Thread payload: run the tasks until the pool is destroyed.
+    void Work();
+
+    std::vector<Cell> cells_;
+    const size_t mask_;
+    char pad0_[64];
+    std::atomic<size_t> tail_;          // Producers
+    char pad1_[64];
+    std::atomic<size_t> head_;          // Consumers
+    char pad2_[64];
+    std::atomic<int> sleeping_;         // Threads waiting on wakeup_
+    std::atomic<bool> done_;
+    std::mutex lock_;
+    std::condition_variable wakeup_;
+    std::vector<Worker*> threads_;
+
+    DECLARE_NON_COPYABLE(ThreadPool);
+};
+} // namespace Threads
+
+#endif // THREAD_POOL_H_
@@ -0,0 +1,176 @@
+#ifndef WORK_STEALING_H_
+#define WORK_STEALING_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <common.h>
+#include <thread.h>
+
+// Work-stealing scheduler for fork-join parallelism.
+// Every worker thread has its own deque of tasks: it pushes the tasks it
+// spawns and pops them at the bottom (the most recent task, whose data is in
+// cache), while idle workers steal from the top of the deques of randomly
+// chosen victims (the oldest tasks, which are usually the largest pieces of
+// work). The deques are lock-free (Chase and Lev, with the memory orders of
+// Le et al.), so a worker that has enough work of its own never waits on
+// other threads. Tasks spawned by other threads go through a shared queue.
+//
+// Spawn()/Sync() are grouped in a TaskGroup: Sync() waits for the tasks
+// spawned in the group, and runs other tasks (its own or stolen ones) while
+// it waits, so nested parallelism does not block workers.
+//
+// ParallelFor() divides a range in halves recursively until the pieces are
+// no larger than the grain; idle workers steal the large halves, so the load
+// is balanced even when the cost of the iterations is not uniform, unlike
+// the static N/num_threads split in threads_mbm.C.
+//
+//  Example:
+//    Threads::WorkStealingScheduler s(4);
+//    s.ParallelFor(0, N, 1024, [&](size_t from, size_t to) {
+//        for (size_t i = from; i < to; ++i) ++data[i];
+//    });
+//    ...
+//    long Fib(Threads::WorkStealingScheduler& s, int n) {
+//        if (n < 2) return n;
+//        long x, y;
+//        Threads::TaskGroup g(s);
+//        g.Spawn([&]() { x = Fib(s, n - 1); });
+//        y = Fib(s, n - 2);
+//        g.Sync();
+//        return x + y;
+//    }
+//
+// Tasks must not throw exceptions. The thread that calls Sync() (or
+// ParallelFor()) runs tasks too, so the scheduler with N workers uses N + 1
+// threads when called from outside. With no workers, the calling thread runs
+// every task when it is spawned.
+
+namespace Threads {
+class TaskGroup;
+
+class WorkStealingScheduler
+{
+    public:
+    // Start num_threads workers (may be 0); each deque holds deque_size
+    // tasks, a task spawned to a full deque runs immediately.
+    explicit WorkStealingScheduler(size_t num_threads, const Thread::Options& options = Thread::Options(), size_t deque_size = 4096);
+
+    // All tasks must have been synced.
+    ~WorkStealingScheduler();
+
+    size_t num_threads() const { return workers_.size(); }
+
+    // Call fn(from, to) on the subranges of [begin, end), at most grain long,
+    // and return when all calls are done.
+    template <typename F> void ParallelFor(size_t begin, size_t end, size_t grain, const F& fn);
+
+    private:
+    friend class TaskGroup;
+
+    class Task {
+        public:
+        explicit Task(TaskGroup* group) : group_(group) {}
+        virtual ~Task() {}
+        virtual void Run() = 0;
+        TaskGroup* group() const { return group_; }
+        private:
+        TaskGroup* const group_;
+    };
+
+    template <typename F> class FunctionTask : public Task {
+        public:
+        FunctionTask(F&& f, TaskGroup* group) : Task(group), f_(std::move(f)) {}
+        virtual void Run() { f_(); }
+        private:
+        F f_;
+    };
+
+    class Deque;
+
+    class Worker : public Thread {
+        public:
+        Worker(WorkStealingScheduler* scheduler, int index, const Thread::Options& options)
+            : Thread(options), scheduler_(scheduler), index_(index) {}
+        protected:
+        virtual void Run() { scheduler_->Work(index_); }
+        private:
+        WorkStealingScheduler* const scheduler_;
+        const int index_;
+    };
+
+    // Queue the task: in the deque of the calling worker, or in the shared
+    // queue if called from another thread.
+    void Spawn(Task* task);
+
+    // Run tasks until all tasks of the group are done.
+    void Wait(TaskGroup* group);
+
+    // A task to run: from the deque of worker self (-1 if the caller is not
+    // a worker), stolen from another worker, or from the shared queue.
+    Task* FindTask(int self);
+    void Execute(Task* task);
+    bool HasWork() const;
+    void WakeUp();
+
+    // Worker payload: run tasks until the scheduler is destroyed.
+    void Work(int index);
+
+    std::vector<Deque*> deques_;
+    std::vector<Worker*> workers_;
+    std::mutex lock_;                   // Protects shared_ and guards wakeup_
+    std::deque<Task*> shared_;
+    std::atomic<size_t> shared_size_;
+    std::condition_variable wakeup_;
+    std::atomic<int> sleeping_;
+    std::atomic<bool> done_;
+
+    DECLARE_NON_COPYABLE(WorkStealingScheduler);
+};
+
+// Tasks spawned by one thread and waited for together. Sync() must be called
+// by the thread that created the group, before the group is destroyed.
+class TaskGroup
+{
+    public:
+    explicit TaskGroup(WorkStealingScheduler& scheduler) : scheduler_(scheduler), pending_(0) {}
+    ~TaskGroup() { CHECK_EQ(pending_.load(), 0) << "TaskGroup destroyed before Sync()"; }
+
+    // Run f() on some thread, maybe later.
+    template <typename F> void Spawn(F f) {
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        scheduler_.Spawn(new WorkStealingScheduler::FunctionTask<F>(std::move(f), this));
+    }
+
+    // Wait for all spawned tasks, running tasks in the meantime.
+    void Sync() { scheduler_.Wait(this); }
+
+    private:
+    friend class WorkStealingScheduler;
+    WorkStealingScheduler& scheduler_;
+    std::atomic<long> pending_;
+
+    DECLARE_NON_COPYABLE(TaskGroup);
+};
+
+template <typename F> void WorkStealingScheduler::ParallelFor(size_t begin, size_t end, size_t grain, const F& fn) {
+    if (grain == 0) grain = 1;
+    TaskGroup g(*this);
+    // Spawn the upper half and keep splitting the lower one.
+    while (end > begin && end - begin > grain) {
+        const size_t middle = begin + (end - begin)/2;
+        g.Spawn([this, middle, end, grain, &fn]() { ParallelFor(middle, end, grain, fn); });
+        end = middle;
+    }
+    if (end > begin) fn(begin, end);
+    g.Sync();
+}
+} // namespace Threads
+
+#endif // WORK_STEALING_H_
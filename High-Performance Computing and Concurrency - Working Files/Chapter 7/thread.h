@@ -53,9 +53,19 @@ class Thread
         // Return the thread stack size.
         size_t stack_size() const { return stack_size_; }
 
+        // Pin the thread to one CPU, from the moment it starts.
+        // By default (or if cpu < 0) the thread can run on any CPU the process
+        // can run on. To choose the CPU, see CPUTopology (cpu-topology.h in
+        // Chapter 3).
+        Options& set_cpu(int cpu) { cpu_ = cpu; return *this; }
+
+        // Return the CPU the thread is pinned to, or -1.
+        int cpu() const { return cpu_; }
+
         private:
         size_t          stack_size_;            // Size of thread stack
         bool            joinable_;              // Thread is joinable?
+        int             cpu_;                   // CPU to pin the thread to, or -1
     };
 
     // Create thread object.